@@ -0,0 +1,430 @@
+#include <stddef.h>
+#include "bcache.h"
+#include "libk/string.h"
+
+/* Check if the compiler thinks you are targeting the wrong operating system. */
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+/* This tutorial will only work for the 32-bit ix86 targets. */
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+#define BCACHE_BUFFERS 64
+#define BCACHE_HASH_BUCKETS 64 /* power of two */
+#define BCACHE_READAHEAD 8     /* blocks fetched past a sequential miss */
+#define BCACHE_DIRTY_LIMIT (BCACHE_BUFFERS / 2)
+
+/*
+ * Buffers are indexed by (device, block) in a hash table and kept on a single
+ * LRU list, most recently used at the head. Eviction takes the coldest buffer
+ * that is neither pinned nor in flight. Dirty buffers are only written when
+ * space runs short, when too many pile up, or on sync, and then all of them
+ * go out together so the block layer can merge neighbours into one command.
+ */
+static Buffer buffers[BCACHE_BUFFERS] __attribute__((aligned(16)));
+static Buffer* hash_buckets[BCACHE_HASH_BUCKETS];
+static Buffer* lru_head = NULL;
+static Buffer* lru_tail = NULL;
+static unsigned int dirty_count = 0;
+static BcacheStats stats;
+
+// Last block handed out, to spot sequential scans for read-ahead.
+static BlockDevice* last_device = NULL;
+static uint32_t last_block = 0;
+
+static size_t bucket_of(const BlockDevice* device, uint32_t block)
+{
+	uintptr_t key = (uintptr_t)device ^ (block * 2654435761u);
+
+	return (size_t)(key ^ (key >> 16)) & (BCACHE_HASH_BUCKETS - 1);
+}
+
+static Buffer* find_buffer(BlockDevice* device, uint32_t block)
+{
+	for (Buffer* buffer = hash_buckets[bucket_of(device, block)]; buffer; buffer = buffer->hash_next) {
+		if (buffer->device == device && buffer->block == block) {
+			return buffer;
+		}
+	}
+
+	return NULL;
+}
+
+static void hash_insert(Buffer* buffer)
+{
+	size_t bucket = bucket_of(buffer->device, buffer->block);
+
+	buffer->hash_next = hash_buckets[bucket];
+	hash_buckets[bucket] = buffer;
+}
+
+static void hash_remove(Buffer* buffer)
+{
+	Buffer** link;
+
+	if (!buffer->device) {
+		return;
+	}
+
+	link = &hash_buckets[bucket_of(buffer->device, buffer->block)];
+
+	while (*link && *link != buffer) {
+		link = &(*link)->hash_next;
+	}
+
+	if (*link) {
+		*link = buffer->hash_next;
+	}
+
+	buffer->hash_next = NULL;
+}
+
+static void lru_unlink(Buffer* buffer)
+{
+	if (buffer->lru_prev) {
+		buffer->lru_prev->lru_next = buffer->lru_next;
+	} else {
+		lru_head = buffer->lru_next;
+	}
+
+	if (buffer->lru_next) {
+		buffer->lru_next->lru_prev = buffer->lru_prev;
+	} else {
+		lru_tail = buffer->lru_prev;
+	}
+
+	buffer->lru_prev = NULL;
+	buffer->lru_next = NULL;
+}
+
+static void lru_push_front(Buffer* buffer)
+{
+	buffer->lru_prev = NULL;
+	buffer->lru_next = lru_head;
+
+	if (lru_head) {
+		lru_head->lru_prev = buffer;
+	} else {
+		lru_tail = buffer;
+	}
+
+	lru_head = buffer;
+}
+
+static void lru_touch(Buffer* buffer)
+{
+	if (lru_head != buffer) {
+		lru_unlink(buffer);
+		lru_push_front(buffer);
+	}
+}
+
+void bcache_init(void)
+{
+	lru_head = NULL;
+	lru_tail = NULL;
+	dirty_count = 0;
+	last_device = NULL;
+	last_block = 0;
+
+	for (size_t i = 0; i < BCACHE_HASH_BUCKETS; ++i) {
+		hash_buckets[i] = NULL;
+	}
+
+	for (size_t i = 0; i < BCACHE_BUFFERS; ++i) {
+		buffers[i].device = NULL;
+		buffers[i].block = 0;
+		buffers[i].refs = 0;
+		buffers[i].flags = 0;
+		buffers[i].hash_next = NULL;
+		lru_push_front(&buffers[i]);
+	}
+
+	stats = (BcacheStats){ 0 };
+}
+
+uint32_t bcache_block_count(const BlockDevice* device)
+{
+	return device ? device->sector_count / BCACHE_SECTORS_PER_BLOCK : 0;
+}
+
+static void submit(Buffer* buffer, int op)
+{
+	buffer->request.op = op;
+	buffer->request.lba = buffer->block * BCACHE_SECTORS_PER_BLOCK;
+	buffer->request.count = BCACHE_SECTORS_PER_BLOCK;
+	buffer->request.buffer = buffer->data;
+
+	if (block_submit(buffer->device, &buffer->request) == 0) {
+		buffer->flags |= BCACHE_IO;
+	} else {
+		buffer->request.status = BLOCK_ERROR;
+	}
+}
+
+// Wait for the buffer's request; returns 0 if it (or nothing) succeeded.
+static int finish_io(Buffer* buffer)
+{
+	int result;
+
+	if (!(buffer->flags & BCACHE_IO)) {
+		return buffer->request.status == BLOCK_ERROR ? -1 : 0;
+	}
+
+	result = block_wait(buffer->device, &buffer->request);
+	buffer->flags &= ~BCACHE_IO;
+	return result;
+}
+
+int bcache_writeback(BlockDevice* device)
+{
+	int result = 0;
+
+	if (dirty_count == 0) {
+		return 0;
+	}
+
+	// Queue every write first, then wait: the block layer sorts and merges
+	// them while the first command is in flight.
+	for (size_t i = 0; i < BCACHE_BUFFERS; ++i) {
+		Buffer* buffer = &buffers[i];
+
+		if ((buffer->flags & BCACHE_DIRTY) && !(buffer->flags & BCACHE_IO)
+			&& (!device || buffer->device == device)) {
+			submit(buffer, BLOCK_WRITE);
+
+			if (!(buffer->flags & BCACHE_IO)) {
+				result = -1;
+			}
+		}
+	}
+
+	for (size_t i = 0; i < BCACHE_BUFFERS; ++i) {
+		Buffer* buffer = &buffers[i];
+
+		if (!(buffer->flags & BCACHE_DIRTY) || !(buffer->flags & BCACHE_IO)
+			|| buffer->request.op != BLOCK_WRITE) {
+			continue;
+		}
+
+		if (finish_io(buffer) == 0) {
+			buffer->flags &= ~BCACHE_DIRTY;
+			--dirty_count;
+			++stats.writebacks;
+		} else {
+			result = -1;
+		}
+	}
+
+	return result;
+}
+
+/*
+ * Claim the coldest idle buffer for (device, block). Clean buffers are always
+ * preferred; a dirty victim triggers one batched write-back of its device.
+ * allow_writeback is false for read-ahead, which should never cost a write.
+ */
+static Buffer* claim_buffer(BlockDevice* device, uint32_t block, bool allow_writeback)
+{
+	Buffer* victim = NULL;
+	Buffer* dirty_victim = NULL;
+
+	for (Buffer* buffer = lru_tail; buffer; buffer = buffer->lru_prev) {
+		if (buffer->refs > 0 || (buffer->flags & BCACHE_IO)) {
+			continue;
+		}
+
+		if (!(buffer->flags & BCACHE_DIRTY)) {
+			victim = buffer;
+			break;
+		}
+
+		if (!dirty_victim) {
+			dirty_victim = buffer;
+		}
+	}
+
+	if (!victim && dirty_victim && allow_writeback) {
+		if (bcache_writeback(dirty_victim->device) != 0 || (dirty_victim->flags & BCACHE_DIRTY)) {
+			return NULL;
+		}
+		victim = dirty_victim;
+	}
+
+	if (!victim) {
+		return NULL;
+	}
+
+	if (victim->flags & BCACHE_VALID) {
+		++stats.evictions;
+	}
+
+	hash_remove(victim);
+	victim->device = device;
+	victim->block = block;
+	victim->flags = 0;
+	victim->request.status = BLOCK_DONE;
+	hash_insert(victim);
+	lru_touch(victim);
+	return victim;
+}
+
+static void forget_buffer(Buffer* buffer)
+{
+	hash_remove(buffer);
+	buffer->device = NULL;
+	buffer->flags = 0;
+	lru_unlink(buffer);
+
+	// Unused buffers go to the cold end so they are reused first.
+	buffer->lru_prev = lru_tail;
+	buffer->lru_next = NULL;
+
+	if (lru_tail) {
+		lru_tail->lru_next = buffer;
+	} else {
+		lru_head = buffer;
+	}
+
+	lru_tail = buffer;
+}
+
+static void read_ahead(BlockDevice* device, uint32_t block)
+{
+	uint32_t limit = bcache_block_count(device);
+
+	for (uint32_t next = block + 1; next <= block + BCACHE_READAHEAD && next < limit; ++next) {
+		Buffer* buffer;
+
+		if (find_buffer(device, next)) {
+			continue;
+		}
+
+		buffer = claim_buffer(device, next, false);
+
+		if (!buffer) {
+			return;
+		}
+
+		submit(buffer, BLOCK_READ);
+
+		if (!(buffer->flags & BCACHE_IO)) {
+			forget_buffer(buffer);
+			return;
+		}
+
+		++stats.readaheads;
+	}
+}
+
+static Buffer* get_buffer(BlockDevice* device, uint32_t block, bool read)
+{
+	Buffer* buffer;
+	bool sequential;
+
+	if (!device || block >= bcache_block_count(device)) {
+		return NULL;
+	}
+
+	sequential = device == last_device && block == last_block + 1;
+	last_device = device;
+	last_block = block;
+
+	buffer = find_buffer(device, block);
+
+	if (buffer) {
+		++stats.hits;
+	} else {
+		++stats.misses;
+		buffer = claim_buffer(device, block, true);
+
+		if (!buffer) {
+			return NULL;
+		}
+
+		if (read) {
+			submit(buffer, BLOCK_READ);
+		} else {
+			memset(buffer->data, 0, BCACHE_BLOCK_SIZE);
+			buffer->flags |= BCACHE_VALID;
+		}
+	}
+
+	++buffer->refs;
+	lru_touch(buffer);
+
+	// Keep the window ahead of a sequential reader filled; the reads queue
+	// behind this one and reach the disk as a single merged command.
+	if (read && sequential) {
+		read_ahead(device, block);
+	}
+
+	if (!(buffer->flags & BCACHE_VALID)) {
+		if (finish_io(buffer) != 0) {
+			--buffer->refs;
+
+			if (buffer->refs == 0) {
+				forget_buffer(buffer);
+			}
+			return NULL;
+		}
+
+		buffer->flags |= BCACHE_VALID;
+	}
+
+	return buffer;
+}
+
+Buffer* bcache_get(BlockDevice* device, uint32_t block)
+{
+	return get_buffer(device, block, true);
+}
+
+Buffer* bcache_get_new(BlockDevice* device, uint32_t block)
+{
+	return get_buffer(device, block, false);
+}
+
+void bcache_release(Buffer* buffer)
+{
+	if (buffer && buffer->refs > 0) {
+		--buffer->refs;
+	}
+}
+
+void bcache_mark_dirty(Buffer* buffer)
+{
+	if (!buffer || (buffer->flags & BCACHE_DIRTY)) {
+		return;
+	}
+
+	buffer->flags |= BCACHE_DIRTY;
+	++dirty_count;
+
+	if (dirty_count > BCACHE_DIRTY_LIMIT) {
+		bcache_writeback(NULL);
+	}
+}
+
+int bcache_sync(void)
+{
+	int result = bcache_writeback(NULL);
+
+	for (size_t i = 0; i < block_device_count(); ++i) {
+		if (block_flush(block_device_at(i)) != 0) {
+			result = -1;
+		}
+	}
+
+	return result;
+}
+
+void bcache_get_stats(BcacheStats* out)
+{
+	if (out) {
+		*out = stats;
+	}
+}
@@ -0,0 +1,59 @@
+#ifndef BCACHE_H
+#define BCACHE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "drivers/block.h"
+
+#define BCACHE_BLOCK_SIZE 1024
+#define BCACHE_SECTORS_PER_BLOCK (BCACHE_BLOCK_SIZE / BLOCK_SECTOR_SIZE)
+
+#define BCACHE_VALID 1 // data matches (or supersedes) the disk
+#define BCACHE_DIRTY 2 // data must be written back before reuse
+#define BCACHE_IO 4    // request in flight; wait before touching data
+
+// One cached filesystem block. data comes first so it keeps the alignment of
+// the buffer array, which DMA needs.
+typedef struct Buffer {
+	uint8_t data[BCACHE_BLOCK_SIZE];
+	BlockDevice* device;
+	uint32_t block;
+	unsigned int refs;
+	unsigned int flags; // BCACHE_* bits
+	struct Buffer* hash_next;
+	struct Buffer* lru_prev;
+	struct Buffer* lru_next;
+	BlockRequest request;
+} Buffer;
+
+typedef struct {
+	unsigned int hits;
+	unsigned int misses;
+	unsigned int readaheads;
+	unsigned int writebacks;
+	unsigned int evictions;
+} BcacheStats;
+
+void bcache_init(void);
+
+// Return the block pinned and filled, or NULL on I/O failure. Every get must
+// be paired with a release.
+Buffer* bcache_get(BlockDevice* device, uint32_t block);
+
+// Like bcache_get but skips the read: the block comes back zeroed (unless it
+// was already cached) for callers that overwrite it completely.
+Buffer* bcache_get_new(BlockDevice* device, uint32_t block);
+
+void bcache_release(Buffer* buffer);
+void bcache_mark_dirty(Buffer* buffer);
+
+// Write back every dirty block of device (all devices when NULL) in one batch.
+int bcache_writeback(BlockDevice* device);
+
+// Write back everything, then flush the device write caches.
+int bcache_sync(void);
+
+uint32_t bcache_block_count(const BlockDevice* device);
+void bcache_get_stats(BcacheStats* out);
+
+#endif
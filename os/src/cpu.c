@@ -0,0 +1,230 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <cpuid.h>
+#include "cpu.h"
+#include "libk/string.h"
+
+/* Check if the compiler thinks you are targeting the wrong operating system. */
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+/* This tutorial will only work for the 32-bit ix86 targets. */
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+#define CPUID_EDX_FPU  (1u << 0)
+#define CPUID_EDX_FXSR (1u << 24)
+#define CPUID_EDX_SSE  (1u << 25)
+#define CPUID_EDX_SSE2 (1u << 26)
+
+#define CR0_MP (1u << 1)
+#define CR0_EM (1u << 2)
+#define CR0_TS (1u << 3)
+#define CR0_NE (1u << 5)
+#define CR4_OSFXSR (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+
+#define FPU_DEFAULT_FCW 0x037f   /* all exceptions masked, 64-bit precision */
+#define FPU_DEFAULT_MXCSR 0x1f80 /* all exceptions masked, round to nearest */
+
+static bool fpu_enabled = false;
+static bool fxsr_enabled = false;
+static bool sse_enabled = false;
+
+/*
+ * fpu_current is the state of the running context and fpu_owner the state
+ * whose values are in the registers right now; NULL means no context. They
+ * differ after a switch until the new context touches the FPU, and while a
+ * kernel section holds the registers (fpu_owner is then NULL).
+ */
+static FpuState* fpu_current = NULL;
+static FpuState* fpu_owner = NULL;
+static unsigned int kernel_fpu_depth = 0;
+static bool task_switched = false;
+
+static uintptr_t read_cr0(void)
+{
+	uintptr_t cr0;
+
+	__asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+	return cr0;
+}
+
+static void write_cr0(uintptr_t cr0)
+{
+	__asm__ volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+}
+
+// CR0.TS makes the next FPU or SSE instruction raise #NM.
+static void set_task_switched(bool on)
+{
+	if (task_switched == on) {
+		return;
+	}
+
+	if (on) {
+		write_cr0(read_cr0() | CR0_TS);
+	} else {
+		__asm__ volatile("clts" : : : "memory");
+	}
+
+	task_switched = on;
+}
+
+static void save_state(FpuState* state)
+{
+	if (fxsr_enabled) {
+		__asm__ volatile("fxsave %0" : "=m"(*state));
+	} else {
+		// fnsave also reinitializes the unit, like the fninit it replaces.
+		__asm__ volatile("fnsave %0" : "=m"(*state));
+	}
+}
+
+static void load_state(const FpuState* state)
+{
+	if (fxsr_enabled) {
+		__asm__ volatile("fxrstor %0" : : "m"(*state));
+	} else {
+		__asm__ volatile("frstor %0" : : "m"(*state));
+	}
+}
+
+void cpu_init_fpu(void)
+{
+	unsigned int eax, ebx, ecx, edx;
+	uintptr_t cr4;
+
+	if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(edx & CPUID_EDX_FPU)) {
+		return;
+	}
+
+	// MP makes wait/fwait honour TS too; NE reports x87 errors as #MF
+	// instead of through the legacy IRQ 13 path.
+	write_cr0((read_cr0() & ~(uintptr_t)(CR0_EM | CR0_TS)) | CR0_MP | CR0_NE);
+	__asm__ volatile("fninit");
+	fpu_enabled = true;
+
+	if (!(edx & CPUID_EDX_FXSR)) {
+		return;
+	}
+
+	__asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+	cr4 |= CR4_OSFXSR;
+
+	if ((edx & (CPUID_EDX_SSE | CPUID_EDX_SSE2)) == (CPUID_EDX_SSE | CPUID_EDX_SSE2)) {
+		cr4 |= CR4_OSXMMEXCPT;
+	}
+
+	__asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+	fxsr_enabled = true;
+
+	if (cr4 & CR4_OSXMMEXCPT) {
+		unsigned int mxcsr = FPU_DEFAULT_MXCSR;
+
+		__asm__ volatile("ldmxcsr %0" : : "m"(mxcsr));
+		sse_enabled = true;
+	}
+}
+
+bool cpu_fpu_enabled(void)
+{
+	return fpu_enabled;
+}
+
+bool cpu_sse_enabled(void)
+{
+	return sse_enabled;
+}
+
+bool kernel_fpu_begin(void)
+{
+	if (!sse_enabled) {
+		return false;
+	}
+
+	if (kernel_fpu_depth++ == 0) {
+		set_task_switched(false);
+
+		if (fpu_owner) {
+			save_state(fpu_owner);
+			fpu_owner = NULL;
+		}
+	}
+
+	return true;
+}
+
+void kernel_fpu_end(void)
+{
+	if (kernel_fpu_depth == 0 || --kernel_fpu_depth > 0) {
+		return;
+	}
+
+	// The running context's registers were saved by kernel_fpu_begin (or
+	// never loaded); make its next FPU instruction bring them back.
+	if (fpu_current) {
+		set_task_switched(true);
+	}
+}
+
+void fpu_state_init(FpuState* state)
+{
+	memset(state->area, 0, sizeof(state->area));
+	state->area[0] = FPU_DEFAULT_FCW & 0xff;
+	state->area[1] = FPU_DEFAULT_FCW >> 8;
+
+	if (fxsr_enabled) {
+		// FXSAVE keeps an abridged tag word where 0 means empty.
+		state->area[24] = FPU_DEFAULT_MXCSR & 0xff;
+		state->area[25] = FPU_DEFAULT_MXCSR >> 8;
+	} else {
+		state->area[8] = 0xff;
+		state->area[9] = 0xff;
+	}
+}
+
+void fpu_switch_to(FpuState* state)
+{
+	fpu_current = state;
+
+	if (!fpu_enabled || kernel_fpu_depth > 0) {
+		return;
+	}
+
+	set_task_switched(state != fpu_owner);
+}
+
+void fpu_handle_unavailable(void)
+{
+	set_task_switched(false);
+
+	if (fpu_owner == fpu_current) {
+		return;
+	}
+
+	if (fpu_owner) {
+		save_state(fpu_owner);
+	}
+
+	if (fpu_current) {
+		load_state(fpu_current);
+	} else {
+		__asm__ volatile("fninit");
+	}
+
+	fpu_owner = fpu_current;
+}
+
+void fpu_release(FpuState* state)
+{
+	if (fpu_owner == state) {
+		fpu_owner = NULL;
+	}
+
+	if (fpu_current == state) {
+		fpu_current = NULL;
+	}
+}
@@ -0,0 +1,46 @@
+#ifndef CPU_H
+#define CPU_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Saved x87/SSE register file of one context, in FXSAVE layout (or FNSAVE
+ * layout on CPUs without FXSR). FXSAVE needs the 16-byte alignment.
+ */
+typedef struct FpuState {
+	uint8_t area[512];
+} __attribute__((aligned(16))) FpuState;
+
+/*
+ * Called from _start before kernel_main. Sets up the x87 unit (CR0.MP and
+ * CR0.NE on, CR0.EM off) and, when the CPU has FXSR and SSE2, turns on
+ * CR4.OSFXSR/OSXMMEXCPT so SSE instructions and FXSAVE may run.
+ */
+void cpu_init_fpu(void);
+bool cpu_fpu_enabled(void);
+bool cpu_sse_enabled(void);
+
+/*
+ * The kernel is compiled without SSE, so vector code must run between these
+ * two calls. kernel_fpu_begin saves the registers of whichever context owns
+ * them and returns false, doing nothing else, if SSE is unavailable. Sections
+ * nest and must not be preempted.
+ */
+bool kernel_fpu_begin(void);
+void kernel_fpu_end(void);
+
+/*
+ * Lazy FPU switching for a scheduler. fpu_switch_to only records the next
+ * context and sets CR0.TS; that context's first FPU instruction raises #NM,
+ * whose handler calls fpu_handle_unavailable to save the previous owner and
+ * load the new state. Contexts that never touch the FPU never pay for it.
+ * Pass NULL for a context without FPU state. fpu_release forgets a state
+ * that is about to be freed.
+ */
+void fpu_state_init(FpuState* state);
+void fpu_switch_to(FpuState* state);
+void fpu_handle_unavailable(void);
+void fpu_release(FpuState* state);
+
+#endif
@@ -0,0 +1,895 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "bcache.h"
+#include "diskfs.h"
+#include "fs.h"
+#include "libk/string.h"
+
+/* Check if the compiler thinks you are targeting the wrong operating system. */
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+/* This tutorial will only work for the 32-bit ix86 targets. */
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+#define DISKFS_MAGIC 0x53465A45u         /* "EZFS" */
+#define DISKFS_JOURNAL_MAGIC 0x4C4E524Au /* "JRNL" */
+#define DISKFS_COMMIT_MAGIC 0x54494D43u  /* "CMIT" */
+#define DISKFS_VERSION 1
+
+#define DISKFS_INODES 256
+#define DISKFS_INODE_SIZE 128
+#define DISKFS_INODES_PER_BLOCK (BCACHE_BLOCK_SIZE / DISKFS_INODE_SIZE)
+#define DISKFS_INODE_BLOCKS (DISKFS_INODES / DISKFS_INODES_PER_BLOCK)
+#define DISKFS_ROOT_INO 1
+#define DISKFS_EXTENTS 8
+#define DISKFS_NAME_MAX 32
+
+#define DISKFS_MAX_BLOCKS 32768 /* 32 MiB; larger disks use only the start */
+#define DISKFS_BITS_PER_BLOCK (BCACHE_BLOCK_SIZE * 8)
+#define DISKFS_MAX_BITMAP_BLOCKS (DISKFS_MAX_BLOCKS / DISKFS_BITS_PER_BLOCK)
+#define DISKFS_MIN_DATA_BLOCKS 64
+
+/* Descriptor, up to DISKFS_TXN_MAX block images, commit record. */
+#define DISKFS_JOURNAL_BLOCKS 64
+#define DISKFS_TXN_MAX (DISKFS_JOURNAL_BLOCKS - 2)
+
+#define DISKFS_FREE 0
+#define DISKFS_FILE 1
+#define DISKFS_DIR 2
+
+/*
+ * On-disk layout in 1 KiB blocks:
+ *   [superblock][bitmap][inode table][journal][data ...]
+ * Directories have no entry blocks: every inode names its parent, so the tree
+ * is rebuilt from the inode table alone. Files are up to DISKFS_EXTENTS runs
+ * of contiguous data blocks.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t block_count;
+	uint32_t inode_count;
+	uint32_t bitmap_start;
+	uint32_t bitmap_blocks;
+	uint32_t inode_start;
+	uint32_t inode_blocks;
+	uint32_t journal_start;
+	uint32_t journal_blocks;
+	uint32_t data_start;
+} DiskSuperblock;
+
+typedef struct {
+	uint32_t start;
+	uint32_t length;
+} DiskExtent;
+
+typedef struct {
+	uint32_t type;
+	uint32_t parent;
+	uint32_t size;
+	uint32_t extent_count;
+	DiskExtent extents[DISKFS_EXTENTS];
+	char name[DISKFS_NAME_MAX];
+	uint32_t reserved[4];
+} DiskInode;
+
+typedef char disk_inode_size_check[sizeof(DiskInode) == DISKFS_INODE_SIZE ? 1 : -1];
+
+/*
+ * Journal descriptor: the home location of each logged block image. The
+ * images follow it, then a commit record whose checksum covers the images;
+ * a transaction without a matching commit record is ignored at replay.
+ */
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t count;
+	uint32_t checksum;
+	uint32_t targets[DISKFS_TXN_MAX];
+} JournalHeader;
+
+typedef struct {
+	uint32_t magic;
+	uint32_t sequence;
+	uint32_t checksum;
+} JournalCommit;
+
+static BlockDevice* disk = NULL;
+static DiskSuperblock super;
+static uint32_t journal_sequence = 0;
+static uint32_t alloc_cursor = 0;
+
+/*
+ * Two copies of the block bitmap. Frees only clear working_bitmap; a block is
+ * handed out again only once it is free in committed_bitmap too, so a sync
+ * never overwrites data that the last committed inodes still point at.
+ */
+static uint8_t working_bitmap[DISKFS_MAX_BLOCKS / 8];
+static uint8_t committed_bitmap[DISKFS_MAX_BLOCKS / 8];
+static bool bitmap_block_dirty[DISKFS_MAX_BITMAP_BLOCKS];
+
+// Which in-memory node each inode belongs to; stale refs mark removals.
+static bool inode_used[DISKFS_INODES];
+static FSNodeRef inode_owner[DISKFS_INODES];
+static FSNode* loaded_nodes[DISKFS_INODES];
+
+// Metadata blocks modified by the open transaction, pinned in the cache and
+// kept clean so nothing reaches their home location before the commit.
+static Buffer* txn_buffers[DISKFS_TXN_MAX];
+static size_t txn_count = 0;
+
+static uint32_t checksum_update(uint32_t hash, const uint8_t* data, size_t len)
+{
+	for (size_t i = 0; i < len; ++i) {
+		hash ^= data[i];
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
+
+static FSNode* root_dir(void)
+{
+	return fs_resolve_path(fs_get_cwd(), "/");
+}
+
+static int write_block(uint32_t block, const void* data, size_t len)
+{
+	Buffer* buffer = bcache_get_new(disk, block);
+
+	if (!buffer) {
+		return -1;
+	}
+
+	memset(buffer->data, 0, BCACHE_BLOCK_SIZE);
+	memcpy(buffer->data, data, len);
+	bcache_mark_dirty(buffer);
+	bcache_release(buffer);
+	return 0;
+}
+
+static int read_block(uint32_t block, void* data, size_t len)
+{
+	Buffer* buffer = bcache_get(disk, block);
+
+	if (!buffer) {
+		return -1;
+	}
+
+	memcpy(data, buffer->data, len);
+	bcache_release(buffer);
+	return 0;
+}
+
+static Buffer* txn_get(uint32_t block)
+{
+	Buffer* buffer;
+
+	for (size_t i = 0; i < txn_count; ++i) {
+		if (txn_buffers[i]->block == block) {
+			return txn_buffers[i];
+		}
+	}
+
+	if (txn_count == DISKFS_TXN_MAX) {
+		return NULL;
+	}
+
+	buffer = bcache_get(disk, block);
+	if (!buffer) {
+		return NULL;
+	}
+
+	txn_buffers[txn_count++] = buffer;
+	return buffer;
+}
+
+static void txn_abandon(void)
+{
+	for (size_t i = 0; i < txn_count; ++i) {
+		bcache_release(txn_buffers[i]);
+	}
+
+	txn_count = 0;
+}
+
+static bool bit_get(const uint8_t* bitmap, uint32_t block)
+{
+	return (bitmap[block / 8] >> (block % 8)) & 1;
+}
+
+static void bit_set(uint32_t block, bool used)
+{
+	if (block >= super.block_count) {
+		return;
+	}
+
+	if (used) {
+		working_bitmap[block / 8] |= (uint8_t)(1u << (block % 8));
+	} else {
+		working_bitmap[block / 8] &= (uint8_t)~(1u << (block % 8));
+	}
+
+	bitmap_block_dirty[block / DISKFS_BITS_PER_BLOCK] = true;
+}
+
+static bool block_available(uint32_t block)
+{
+	return !bit_get(working_bitmap, block) && !bit_get(committed_bitmap, block);
+}
+
+/* First fit from a rotating cursor; returns the run start or 0 when full. */
+static uint32_t allocate_run(uint32_t wanted, uint32_t* length)
+{
+	uint32_t span = super.block_count - super.data_start;
+
+	for (uint32_t scanned = 0; scanned < span; ++scanned) {
+		uint32_t start = super.data_start + (alloc_cursor + scanned) % span;
+		uint32_t run = 0;
+
+		if (!block_available(start)) {
+			continue;
+		}
+
+		while (run < wanted && start + run < super.block_count && block_available(start + run)) {
+			bit_set(start + run, true);
+			++run;
+		}
+
+		alloc_cursor = start + run - super.data_start;
+		*length = run;
+		return start;
+	}
+
+	return 0;
+}
+
+static void free_extents(DiskInode* inode)
+{
+	for (uint32_t i = 0; i < inode->extent_count && i < DISKFS_EXTENTS; ++i) {
+		for (uint32_t b = 0; b < inode->extents[i].length; ++b) {
+			bit_set(inode->extents[i].start + b, false);
+		}
+	}
+
+	inode->extent_count = 0;
+}
+
+static int read_inode(uint32_t ino, DiskInode* inode)
+{
+	Buffer* buffer = bcache_get(disk, super.inode_start + ino / DISKFS_INODES_PER_BLOCK);
+
+	if (!buffer) {
+		return -1;
+	}
+
+	memcpy(inode, buffer->data + (ino % DISKFS_INODES_PER_BLOCK) * DISKFS_INODE_SIZE, sizeof(*inode));
+	bcache_release(buffer);
+	return 0;
+}
+
+static int write_inode(uint32_t ino, const DiskInode* inode)
+{
+	Buffer* buffer = txn_get(super.inode_start + ino / DISKFS_INODES_PER_BLOCK);
+
+	if (!buffer) {
+		return -1;
+	}
+
+	memcpy(buffer->data + (ino % DISKFS_INODES_PER_BLOCK) * DISKFS_INODE_SIZE, inode, sizeof(*inode));
+	return 0;
+}
+
+/* Give a file fresh extents and write its bytes there. */
+static int write_file_data(FSNode* file, DiskInode* inode)
+{
+	uint32_t blocks = (uint32_t)((fs_size(file) + BCACHE_BLOCK_SIZE - 1) / BCACHE_BLOCK_SIZE);
+	size_t offset = 0;
+
+	inode->extent_count = 0;
+
+	while (blocks > 0) {
+		uint32_t length;
+		uint32_t start;
+
+		if (inode->extent_count == DISKFS_EXTENTS || !(start = allocate_run(blocks, &length))) {
+			free_extents(inode);
+			return -1;
+		}
+
+		inode->extents[inode->extent_count].start = start;
+		inode->extents[inode->extent_count].length = length;
+		++inode->extent_count;
+		blocks -= length;
+
+		for (uint32_t b = 0; b < length; ++b) {
+			Buffer* buffer = bcache_get_new(disk, start + b);
+
+			if (!buffer) {
+				free_extents(inode);
+				return -1;
+			}
+
+			memset(buffer->data, 0, BCACHE_BLOCK_SIZE);
+			fs_read_range(file, offset, (char*)buffer->data, BCACHE_BLOCK_SIZE);
+			bcache_mark_dirty(buffer);
+			bcache_release(buffer);
+			offset += BCACHE_BLOCK_SIZE;
+		}
+	}
+
+	return 0;
+}
+
+static uint32_t allocate_inode(void)
+{
+	for (uint32_t ino = DISKFS_ROOT_INO + 1; ino < DISKFS_INODES; ++ino) {
+		if (!inode_used[ino]) {
+			inode_used[ino] = true;
+			return ino;
+		}
+	}
+
+	return 0;
+}
+
+static int release_inode(uint32_t ino)
+{
+	DiskInode inode;
+
+	if (read_inode(ino, &inode) != 0) {
+		return -1;
+	}
+
+	free_extents(&inode);
+	memset(&inode, 0, sizeof(inode));
+
+	if (write_inode(ino, &inode) != 0) {
+		return -1;
+	}
+
+	inode_used[ino] = false;
+	inode_owner[ino].node = NULL;
+	return 0;
+}
+
+static int persist_node(FSNode* node, FSNode* root)
+{
+	DiskInode inode;
+	uint32_t ino = node->ino;
+	bool fresh = ino == 0;
+	uint32_t old_extent_count;
+	DiskExtent old_extents[DISKFS_EXTENTS];
+
+	if (fresh) {
+		ino = allocate_inode();
+		if (ino == 0) {
+			return -1;
+		}
+		memset(&inode, 0, sizeof(inode));
+	} else if (read_inode(ino, &inode) != 0) {
+		return -1;
+	}
+
+	old_extent_count = inode.extent_count;
+	memcpy(old_extents, inode.extents, sizeof(old_extents));
+
+	inode.type = fs_is_dir(node) ? DISKFS_DIR : DISKFS_FILE;
+	inode.parent = node->parent == root ? DISKFS_ROOT_INO : node->parent->ino;
+	memset(inode.name, 0, sizeof(inode.name));
+	strlcpy(inode.name, fs_name(node), sizeof(inode.name));
+
+	if (fs_is_file(node) && (fresh || (node->flags & FS_NODE_DIRTY_DATA))) {
+		// New bytes always go to new blocks; the old run is only freed in the
+		// working bitmap and stays untouched until this transaction commits.
+		inode.size = (uint32_t)fs_size(node);
+
+		if (write_file_data(node, &inode) != 0) {
+			inode.extent_count = old_extent_count;
+			memcpy(inode.extents, old_extents, sizeof(old_extents));
+			if (fresh) {
+				inode_used[ino] = false;
+			}
+			return -1;
+		}
+
+		for (uint32_t i = 0; i < old_extent_count && i < DISKFS_EXTENTS; ++i) {
+			for (uint32_t b = 0; b < old_extents[i].length; ++b) {
+				bit_set(old_extents[i].start + b, false);
+			}
+		}
+	}
+
+	if (write_inode(ino, &inode) != 0) {
+		if (fresh) {
+			inode_used[ino] = false;
+		}
+		return -1;
+	}
+
+	node->ino = ino;
+	node->flags &= ~(FS_NODE_DIRTY | FS_NODE_DIRTY_DATA);
+	inode_owner[ino] = fs_ref(node);
+	return 0;
+}
+
+static int commit(void)
+{
+	JournalHeader header;
+	JournalCommit record;
+	uint32_t checksum = 2166136261u;
+
+	for (uint32_t i = 0; i < super.bitmap_blocks; ++i) {
+		Buffer* buffer;
+
+		if (!bitmap_block_dirty[i]) {
+			continue;
+		}
+
+		buffer = txn_get(super.bitmap_start + i);
+		if (!buffer) {
+			return -1;
+		}
+
+		memcpy(buffer->data, working_bitmap + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE);
+		bitmap_block_dirty[i] = false;
+	}
+
+	if (txn_count == 0) {
+		return 0;
+	}
+
+	// 1. Log the block images and the descriptor. File data written during
+	//    this sync goes out in the same batch, ahead of the commit record.
+	memset(&header, 0, sizeof(header));
+	header.magic = DISKFS_JOURNAL_MAGIC;
+	header.sequence = journal_sequence;
+	header.count = (uint32_t)txn_count;
+
+	for (size_t i = 0; i < txn_count; ++i) {
+		header.targets[i] = txn_buffers[i]->block;
+		checksum = checksum_update(checksum, txn_buffers[i]->data, BCACHE_BLOCK_SIZE);
+
+		if (write_block(super.journal_start + 1 + (uint32_t)i, txn_buffers[i]->data, BCACHE_BLOCK_SIZE) != 0) {
+			return -1;
+		}
+	}
+
+	header.checksum = checksum;
+
+	if (write_block(super.journal_start, &header, sizeof(header)) != 0 || bcache_sync() != 0) {
+		return -1;
+	}
+
+	// 2. The commit record makes the transaction durable.
+	record.magic = DISKFS_COMMIT_MAGIC;
+	record.sequence = journal_sequence;
+	record.checksum = checksum;
+
+	if (write_block(super.journal_start + 1 + header.count, &record, sizeof(record)) != 0
+		|| bcache_sync() != 0) {
+		return -1;
+	}
+
+	// 3. Checkpoint: let the images reach their home locations.
+	for (size_t i = 0; i < txn_count; ++i) {
+		bcache_mark_dirty(txn_buffers[i]);
+		bcache_release(txn_buffers[i]);
+	}
+
+	txn_count = 0;
+	memcpy(committed_bitmap, working_bitmap, sizeof(committed_bitmap));
+
+	if (bcache_sync() != 0) {
+		return -1;
+	}
+
+	// 4. Retire the transaction so it is not replayed again.
+	memset(&header, 0, sizeof(header));
+	header.magic = DISKFS_JOURNAL_MAGIC;
+	header.sequence = ++journal_sequence;
+
+	if (write_block(super.journal_start, &header, sizeof(header)) != 0) {
+		return -1;
+	}
+
+	return bcache_sync();
+}
+
+static int replay_journal(void)
+{
+	static JournalHeader header;
+	JournalCommit record;
+	uint32_t checksum = 2166136261u;
+	uint8_t image[BCACHE_BLOCK_SIZE];
+
+	if (read_block(super.journal_start, &header, sizeof(header)) != 0) {
+		return -1;
+	}
+
+	if (header.magic != DISKFS_JOURNAL_MAGIC) {
+		journal_sequence = 0;
+		return 0;
+	}
+
+	journal_sequence = header.sequence;
+
+	if (header.count == 0 || header.count > DISKFS_TXN_MAX) {
+		return 0;
+	}
+
+	if (read_block(super.journal_start + 1 + header.count, &record, sizeof(record)) != 0) {
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < header.count; ++i) {
+		if (read_block(super.journal_start + 1 + i, image, sizeof(image)) != 0) {
+			return -1;
+		}
+		checksum = checksum_update(checksum, image, sizeof(image));
+	}
+
+	// A torn transaction never committed; the home blocks are still intact.
+	if (record.magic == DISKFS_COMMIT_MAGIC && record.sequence == header.sequence
+		&& record.checksum == checksum && header.checksum == checksum) {
+		for (uint32_t i = 0; i < header.count; ++i) {
+			uint32_t target = header.targets[i];
+
+			if (target >= super.journal_start || read_block(super.journal_start + 1 + i, image, sizeof(image)) != 0
+				|| write_block(target, image, sizeof(image)) != 0) {
+				return -1;
+			}
+		}
+
+		if (bcache_sync() != 0) {
+			return -1;
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = DISKFS_JOURNAL_MAGIC;
+	header.sequence = ++journal_sequence;
+
+	if (write_block(super.journal_start, &header, sizeof(header)) != 0) {
+		return -1;
+	}
+
+	return bcache_sync();
+}
+
+static bool valid_superblock(const DiskSuperblock* sb, const BlockDevice* device)
+{
+	return sb->magic == DISKFS_MAGIC && sb->version == DISKFS_VERSION
+		&& sb->block_count <= bcache_block_count(device) && sb->block_count <= DISKFS_MAX_BLOCKS
+		&& sb->inode_count == DISKFS_INODES && sb->bitmap_start == 1
+		&& sb->bitmap_blocks == (sb->block_count + DISKFS_BITS_PER_BLOCK - 1) / DISKFS_BITS_PER_BLOCK
+		&& sb->inode_start == sb->bitmap_start + sb->bitmap_blocks && sb->inode_blocks == DISKFS_INODE_BLOCKS
+		&& sb->journal_start == sb->inode_start + sb->inode_blocks
+		&& sb->journal_blocks == DISKFS_JOURNAL_BLOCKS
+		&& sb->data_start == sb->journal_start + sb->journal_blocks && sb->data_start < sb->block_count;
+}
+
+static void reset_state(void)
+{
+	txn_abandon();
+	alloc_cursor = 0;
+
+	for (size_t i = 0; i < DISKFS_INODES; ++i) {
+		inode_used[i] = false;
+		inode_owner[i].node = NULL;
+		loaded_nodes[i] = NULL;
+	}
+
+	for (size_t i = 0; i < DISKFS_MAX_BITMAP_BLOCKS; ++i) {
+		bitmap_block_dirty[i] = false;
+	}
+}
+
+static int load_file(FSNode* file, const DiskInode* inode)
+{
+	size_t offset = 0;
+
+	for (uint32_t i = 0; i < inode->extent_count && i < DISKFS_EXTENTS; ++i) {
+		for (uint32_t b = 0; b < inode->extents[i].length && offset < inode->size; ++b) {
+			Buffer* buffer = bcache_get(disk, inode->extents[i].start + b);
+			size_t chunk = inode->size - offset;
+			int written;
+
+			if (!buffer) {
+				return -1;
+			}
+
+			if (chunk > BCACHE_BLOCK_SIZE) {
+				chunk = BCACHE_BLOCK_SIZE;
+			}
+
+			written = fs_write_range(file, offset, (const char*)buffer->data, chunk);
+			bcache_release(buffer);
+
+			if (written < 0) {
+				return -1;
+			}
+
+			offset += chunk;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Rebuild the tree from the inode table. Inodes only name their parent, so
+ * keep sweeping until no pass attaches anything new; whatever is left is
+ * unreachable and stays reserved rather than being reused.
+ */
+static int load_tree(FSNode* root)
+{
+	static DiskInode inodes[DISKFS_INODES];
+	static bool visited[DISKFS_INODES];
+	bool progress = true;
+	int result = 0;
+
+	for (uint32_t ino = 0; ino < DISKFS_INODES; ++ino) {
+		if (read_inode(ino, &inodes[ino]) != 0) {
+			return -1;
+		}
+		inode_used[ino] = ino <= DISKFS_ROOT_INO || inodes[ino].type != DISKFS_FREE;
+		visited[ino] = false;
+	}
+
+	loaded_nodes[DISKFS_ROOT_INO] = root;
+
+	while (progress) {
+		progress = false;
+
+		for (uint32_t ino = DISKFS_ROOT_INO + 1; ino < DISKFS_INODES; ++ino) {
+			const DiskInode* inode = &inodes[ino];
+			FSNode* parent;
+			FSNode* node;
+			char name[DISKFS_NAME_MAX];
+
+			if (inode->type == DISKFS_FREE || visited[ino] || inode->parent >= DISKFS_INODES
+				|| !(parent = loaded_nodes[inode->parent])) {
+				continue;
+			}
+
+			memcpy(name, inode->name, sizeof(name));
+			name[sizeof(name) - 1] = '\0';
+
+			node = fs_lookup(parent, name);
+
+			if (!node) {
+				node = inode->type == DISKFS_DIR ? fs_create_dir(parent, name) : fs_create_file(parent, name);
+			} else if ((node->flags & FS_NODE_READONLY) || fs_is_dir(node) != (inode->type == DISKFS_DIR)) {
+				node = NULL;
+			}
+
+			// Mark the inode as visited even on failure so the sweep ends; its
+			// children then stay unattached.
+			visited[ino] = true;
+			loaded_nodes[ino] = node;
+			progress = true;
+
+			if (!node) {
+				result = -1;
+				continue;
+			}
+
+			if (inode->type == DISKFS_FILE && load_file(node, inode) != 0) {
+				result = -1;
+			}
+
+			node->ino = ino;
+			node->flags &= ~(FS_NODE_DIRTY | FS_NODE_DIRTY_DATA);
+			inode_owner[ino] = fs_ref(node);
+		}
+	}
+
+	return result;
+}
+
+int diskfs_mount(BlockDevice* device)
+{
+	DiskSuperblock sb;
+
+	if (!device) {
+		return -1;
+	}
+
+	reset_state();
+	disk = device;
+
+	if (read_block(0, &sb, sizeof(sb)) != 0 || !valid_superblock(&sb, device)) {
+		disk = NULL;
+		return -1;
+	}
+
+	super = sb;
+
+	if (replay_journal() != 0) {
+		disk = NULL;
+		return -1;
+	}
+
+	for (uint32_t i = 0; i < super.bitmap_blocks; ++i) {
+		if (read_block(super.bitmap_start + i, working_bitmap + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE) != 0) {
+			disk = NULL;
+			return -1;
+		}
+	}
+
+	memcpy(committed_bitmap, working_bitmap, sizeof(committed_bitmap));
+
+	// A partially loaded tree is still mounted; unloaded inodes stay on disk.
+	return load_tree(root_dir());
+}
+
+/* Write an empty filesystem described by super: bitmap, root inode, journal. */
+static int write_layout(void)
+{
+	DiskInode inodes[DISKFS_INODES_PER_BLOCK];
+	JournalHeader header;
+
+	memset(working_bitmap, 0, sizeof(working_bitmap));
+	for (uint32_t b = 0; b < super.data_start; ++b) {
+		bit_set(b, true);
+	}
+
+	for (uint32_t i = 0; i < super.bitmap_blocks; ++i) {
+		if (write_block(super.bitmap_start + i, working_bitmap + i * BCACHE_BLOCK_SIZE, BCACHE_BLOCK_SIZE) != 0) {
+			return -1;
+		}
+		bitmap_block_dirty[i] = false;
+	}
+
+	memcpy(committed_bitmap, working_bitmap, sizeof(committed_bitmap));
+
+	// Inode 0 is never used; the root directory is inode 1.
+	memset(inodes, 0, sizeof(inodes));
+	inodes[DISKFS_ROOT_INO].type = DISKFS_DIR;
+	inodes[DISKFS_ROOT_INO].parent = DISKFS_ROOT_INO;
+	inodes[DISKFS_ROOT_INO].name[0] = '/';
+
+	for (uint32_t i = 0; i < super.inode_blocks; ++i) {
+		if (write_block(super.inode_start + i, i == 0 ? inodes : NULL, i == 0 ? sizeof(inodes) : 0) != 0) {
+			return -1;
+		}
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = DISKFS_JOURNAL_MAGIC;
+
+	if (write_block(super.journal_start, &header, sizeof(header)) != 0) {
+		return -1;
+	}
+
+	// The superblock goes last so a half-written format is never mounted.
+	if (bcache_sync() != 0 || write_block(0, &super, sizeof(super)) != 0) {
+		return -1;
+	}
+
+	inode_used[0] = true;
+	inode_used[DISKFS_ROOT_INO] = true;
+	return bcache_sync();
+}
+
+static int forget_walked(FSNode* node, int depth, void* ctx)
+{
+	(void)depth;
+	(void)ctx;
+
+	node->ino = 0;
+	node->flags |= FS_NODE_DIRTY | FS_NODE_DIRTY_DATA;
+	return FS_WALK_CONTINUE;
+}
+
+int diskfs_mkfs(BlockDevice* device)
+{
+	DiskSuperblock sb;
+	uint32_t blocks = bcache_block_count(device);
+
+	if (blocks > DISKFS_MAX_BLOCKS) {
+		blocks = DISKFS_MAX_BLOCKS;
+	}
+
+	memset(&sb, 0, sizeof(sb));
+	sb.magic = DISKFS_MAGIC;
+	sb.version = DISKFS_VERSION;
+	sb.block_count = blocks;
+	sb.inode_count = DISKFS_INODES;
+	sb.bitmap_start = 1;
+	sb.bitmap_blocks = (blocks + DISKFS_BITS_PER_BLOCK - 1) / DISKFS_BITS_PER_BLOCK;
+	sb.inode_start = sb.bitmap_start + sb.bitmap_blocks;
+	sb.inode_blocks = DISKFS_INODE_BLOCKS;
+	sb.journal_start = sb.inode_start + sb.inode_blocks;
+	sb.journal_blocks = DISKFS_JOURNAL_BLOCKS;
+	sb.data_start = sb.journal_start + sb.journal_blocks;
+
+	if (!device || blocks < sb.data_start + DISKFS_MIN_DATA_BLOCKS) {
+		return -1;
+	}
+
+	reset_state();
+	disk = device;
+	super = sb;
+	journal_sequence = 0;
+
+	if (write_layout() != 0) {
+		disk = NULL;
+		return -1;
+	}
+
+	// Everything currently in memory is new to this disk.
+	fs_walk(root_dir(), forget_walked, NULL, NULL);
+
+	return diskfs_sync();
+}
+
+typedef struct {
+	FSNode* root;
+	int result;
+} SyncWalk;
+
+// Read-only subtrees (the initrd) are rebuilt at boot and never stored. A
+// node that could not be written keeps its children off the disk as well.
+static int persist_walked(FSNode* node, int depth, void* ctx)
+{
+	SyncWalk* walk = ctx;
+
+	if (depth == 0) {
+		return FS_WALK_CONTINUE;
+	}
+
+	if (node->flags & FS_NODE_READONLY) {
+		return FS_WALK_SKIP;
+	}
+
+	if (node->ino != 0 && !(node->flags & (FS_NODE_DIRTY | FS_NODE_DIRTY_DATA))) {
+		return FS_WALK_CONTINUE;
+	}
+
+	if ((node->parent != walk->root && node->parent->ino == 0) || persist_node(node, walk->root) != 0) {
+		walk->result = -1;
+		return FS_WALK_SKIP;
+	}
+
+	return FS_WALK_CONTINUE;
+}
+
+int diskfs_sync(void)
+{
+	SyncWalk walk;
+
+	if (!disk) {
+		return 0;
+	}
+
+	walk.root = root_dir();
+	walk.result = 0;
+
+	// Inodes whose node is gone (removed, possibly with its slot reused).
+	for (uint32_t ino = DISKFS_ROOT_INO + 1; ino < DISKFS_INODES; ++ino) {
+		if (inode_owner[ino].node && !fs_ref_get(inode_owner[ino]) && release_inode(ino) != 0) {
+			walk.result = -1;
+		}
+	}
+
+	// Pre-order walk so a parent has its inode before its children need it.
+	fs_walk(walk.root, persist_walked, NULL, &walk);
+
+	if (commit() != 0) {
+		return -1;
+	}
+
+	return walk.result;
+}
+
+BlockDevice* diskfs_device(void)
+{
+	return disk;
+}
@@ -0,0 +1,25 @@
+#ifndef DISKFS_H
+#define DISKFS_H
+
+#include "drivers/block.h"
+
+/*
+ * Persistent copy of the FSNode tree. The in-memory tree stays the working
+ * set; diskfs loads it at mount and writes back whatever changed on sync.
+ * Metadata updates go through a write-ahead journal, so a crash leaves either
+ * the previous or the new state after the journal is replayed.
+ */
+
+// Load the tree stored on device into the in-memory filesystem. Returns -1
+// if the device holds no EnzOS filesystem.
+int diskfs_mount(BlockDevice* device);
+
+// Format device and write the current in-memory tree to it.
+int diskfs_mkfs(BlockDevice* device);
+
+// Commit every change since the last sync as one journal transaction.
+int diskfs_sync(void);
+
+BlockDevice* diskfs_device(void);
+
+#endif
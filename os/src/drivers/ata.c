@@ -0,0 +1,487 @@
+#include "ata.h"
+#include "block.h"
+#include "io.h"
+#include "pci.h"
+
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+/* Task file registers, relative to the channel's I/O base. */
+#define ATA_REG_DATA 0
+#define ATA_REG_FEATURES 1
+#define ATA_REG_SECTOR_COUNT 2
+#define ATA_REG_LBA_LOW 3
+#define ATA_REG_LBA_MID 4
+#define ATA_REG_LBA_HIGH 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+#define ATA_STATUS_ERR 0x01
+#define ATA_STATUS_DRQ 0x08
+#define ATA_STATUS_DF 0x20
+#define ATA_STATUS_BSY 0x80
+
+/* Device control register bits. */
+#define ATA_CONTROL_NIEN 0x02
+#define ATA_CONTROL_SRST 0x04
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_FLUSH_CACHE 0xE7
+#define ATA_CMD_IDENTIFY 0xEC
+
+/* Bus master IDE registers, relative to the channel's bus master base. */
+#define BM_REG_COMMAND 0
+#define BM_REG_STATUS 2
+#define BM_REG_PRDT 4
+
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08
+
+#define BM_STATUS_ACTIVE 0x01
+#define BM_STATUS_ERR 0x02
+#define BM_STATUS_IRQ 0x04
+
+#define ATA_PRD_ENTRIES 64
+#define ATA_PRD_END 0x8000
+#define ATA_MAX_SECTORS 256
+#define ATA_LBA28_LIMIT 0x0FFFFFFFu
+#define ATA_TIMEOUT 10000000u
+
+/*
+ * Physical region descriptor: one contiguous piece of a DMA transfer. A region
+ * may not cross a 64 KiB boundary; a byte count of 0 means 64 KiB.
+ */
+typedef struct {
+        uint32_t address;
+        uint16_t byte_count;
+        uint16_t flags;
+} __attribute__((packed)) AtaPrd;
+
+typedef struct AtaDrive AtaDrive;
+
+typedef struct {
+        uint16_t io_base;
+        uint16_t control_base;
+        uint16_t bm_base;
+        AtaPrd* prd;
+        AtaDrive* owner;
+        unsigned polls;
+} AtaChannel;
+
+struct AtaDrive {
+        AtaChannel* channel;
+        uint8_t slave;
+        bool dma;
+        BlockDevice block;
+};
+
+/*
+ * The table must be dword aligned and may not cross a 64 KiB boundary; 512
+ * bytes aligned to 512 satisfies both. Paging identity-maps all of RAM, so
+ * the virtual address of the table, and of every data buffer, is also the
+ * physical address the controller needs and can be used directly.
+ */
+static AtaPrd prd_tables[2][ATA_PRD_ENTRIES] __attribute__((aligned(512)));
+static AtaChannel channels[2];
+static AtaDrive drives[4];
+
+static void ata_delay(const AtaChannel* channel)
+{
+        // Each alternate status read takes ~100ns; four give the drive the
+        // 400ns it needs after a drive select.
+        for (int i = 0; i < 4; ++i) {
+                inb(channel->control_base);
+        }
+}
+
+static int ata_wait_not_busy(const AtaChannel* channel)
+{
+        for (unsigned i = 0; i < ATA_TIMEOUT; ++i) {
+                uint8_t status = inb(channel->io_base + ATA_REG_STATUS);
+
+                if (!(status & ATA_STATUS_BSY)) {
+                        return status;
+                }
+        }
+
+        return -1;
+}
+
+static int ata_wait_drq(const AtaChannel* channel)
+{
+        for (unsigned i = 0; i < ATA_TIMEOUT; ++i) {
+                uint8_t status = inb(channel->io_base + ATA_REG_STATUS);
+
+                if (status & ATA_STATUS_BSY) {
+                        continue;
+                }
+
+                if (status & (ATA_STATUS_ERR | ATA_STATUS_DF)) {
+                        return -1;
+                }
+
+                if (status & ATA_STATUS_DRQ) {
+                        return 0;
+                }
+        }
+
+        return -1;
+}
+
+static void ata_soft_reset(const AtaChannel* channel)
+{
+        outb(channel->control_base, ATA_CONTROL_SRST | ATA_CONTROL_NIEN);
+        ata_delay(channel);
+        outb(channel->control_base, ATA_CONTROL_NIEN);
+        ata_wait_not_busy(channel);
+}
+
+static void ata_setup_lba(const AtaDrive* drive, uint32_t lba, uint32_t count)
+{
+        const AtaChannel* channel = drive->channel;
+
+        outb(channel->io_base + ATA_REG_DRIVE,
+                (uint8_t)(0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F)));
+        ata_delay(channel);
+        outb(channel->io_base + ATA_REG_FEATURES, 0);
+        // A sector count of 0 asks for 256 sectors.
+        outb(channel->io_base + ATA_REG_SECTOR_COUNT, (uint8_t)count);
+        outb(channel->io_base + ATA_REG_LBA_LOW, (uint8_t)lba);
+        outb(channel->io_base + ATA_REG_LBA_MID, (uint8_t)(lba >> 8));
+        outb(channel->io_base + ATA_REG_LBA_HIGH, (uint8_t)(lba >> 16));
+}
+
+/* Wait for the other drive on the channel to finish its queued work. */
+static void ata_claim_channel(AtaDrive* drive)
+{
+        AtaChannel* channel = drive->channel;
+
+        while (channel->owner && channel->owner != drive) {
+                block_drain(&channel->owner->block);
+        }
+}
+
+static int ata_pio_transfer(AtaDrive* drive, BlockRequest* chain)
+{
+        const AtaChannel* channel = drive->channel;
+
+        for (BlockRequest* request = chain; request; request = request->merge_next) {
+                char* cursor = request->buffer;
+                int status;
+
+                if (ata_wait_not_busy(channel) < 0) {
+                        return -1;
+                }
+
+                ata_setup_lba(drive, request->lba, request->count);
+                outb(channel->io_base + ATA_REG_COMMAND,
+                        request->op == BLOCK_WRITE ? ATA_CMD_WRITE_PIO : ATA_CMD_READ_PIO);
+
+                for (uint32_t i = 0; i < request->count; ++i) {
+                        if (ata_wait_drq(channel) < 0) {
+                                return -1;
+                        }
+
+                        if (request->op == BLOCK_WRITE) {
+                                outsw(channel->io_base + ATA_REG_DATA, cursor, BLOCK_SECTOR_SIZE / 2);
+                        } else {
+                                insw(channel->io_base + ATA_REG_DATA, cursor, BLOCK_SECTOR_SIZE / 2);
+                        }
+
+                        cursor += BLOCK_SECTOR_SIZE;
+                }
+
+                status = ata_wait_not_busy(channel);
+
+                if (status < 0 || (status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+                        return -1;
+                }
+        }
+
+        return 0;
+}
+
+/*
+ * Describe a merged chain as one scatter-gather list. Returns false when a
+ * buffer is not word aligned or the table runs out, so the caller can fall
+ * back to PIO for this chain.
+ */
+static bool ata_build_prd(AtaChannel* channel, const BlockRequest* chain)
+{
+        size_t entries = 0;
+
+        for (const BlockRequest* request = chain; request; request = request->merge_next) {
+                uint32_t address = (uint32_t)(uintptr_t)request->buffer;
+                uint32_t remaining = request->count * BLOCK_SECTOR_SIZE;
+
+                if (address & 1) {
+                        return false;
+                }
+
+                while (remaining > 0) {
+                        uint32_t room = 0x10000u - (address & 0xFFFFu);
+                        uint32_t length = remaining < room ? remaining : room;
+
+                        if (entries == ATA_PRD_ENTRIES) {
+                                return false;
+                        }
+
+                        channel->prd[entries].address = address;
+                        channel->prd[entries].byte_count = (uint16_t)length;
+                        channel->prd[entries].flags = 0;
+                        ++entries;
+                        address += length;
+                        remaining -= length;
+                }
+        }
+
+        if (entries == 0) {
+                return false;
+        }
+
+        channel->prd[entries - 1].flags = ATA_PRD_END;
+        return true;
+}
+
+static int ata_start(BlockDevice* device, BlockRequest* chain)
+{
+        AtaDrive* drive = device->driver_data;
+        AtaChannel* channel = drive->channel;
+        uint32_t sectors = 0;
+        uint8_t direction;
+
+        ata_claim_channel(drive);
+
+        for (const BlockRequest* request = chain; request; request = request->merge_next) {
+                sectors += request->count;
+        }
+
+        if (!drive->dma || !ata_build_prd(channel, chain) || ata_wait_not_busy(channel) < 0) {
+                return ata_pio_transfer(drive, chain) == 0 ? 1 : -1;
+        }
+
+        // The bus master "read" bit means the controller writes to memory.
+        direction = chain->op == BLOCK_WRITE ? 0 : BM_CMD_READ;
+
+        outb(channel->bm_base + BM_REG_COMMAND, 0);
+        outl(channel->bm_base + BM_REG_PRDT, (uint32_t)(uintptr_t)channel->prd);
+        outb(channel->bm_base + BM_REG_COMMAND, direction);
+        outb(channel->bm_base + BM_REG_STATUS,
+                inb(channel->bm_base + BM_REG_STATUS) | BM_STATUS_ERR | BM_STATUS_IRQ);
+
+        ata_setup_lba(drive, chain->lba, sectors);
+        outb(channel->io_base + ATA_REG_COMMAND,
+                chain->op == BLOCK_WRITE ? ATA_CMD_WRITE_DMA : ATA_CMD_READ_DMA);
+        outb(channel->bm_base + BM_REG_COMMAND, direction | BM_CMD_START);
+
+        channel->owner = drive;
+        channel->polls = 0;
+        return 0;
+}
+
+static int ata_poll(BlockDevice* device)
+{
+        AtaDrive* drive = device->driver_data;
+        AtaChannel* channel = drive->channel;
+        uint8_t bm_status = inb(channel->bm_base + BM_REG_STATUS);
+        uint8_t status = 0;
+        bool failed = false;
+
+        if ((bm_status & BM_STATUS_ACTIVE) && !(bm_status & (BM_STATUS_ERR | BM_STATUS_IRQ))) {
+                if (++channel->polls < ATA_TIMEOUT) {
+                        return 0;
+                }
+                failed = true;
+        } else {
+                status = inb(channel->io_base + ATA_REG_STATUS);
+
+                if (status & ATA_STATUS_BSY) {
+                        if (++channel->polls < ATA_TIMEOUT) {
+                                return 0;
+                        }
+                        failed = true;
+                }
+        }
+
+        outb(channel->bm_base + BM_REG_COMMAND, 0);
+        outb(channel->bm_base + BM_REG_STATUS, bm_status | BM_STATUS_ERR | BM_STATUS_IRQ);
+        channel->owner = NULL;
+
+        if (!failed && !(bm_status & BM_STATUS_ERR) && !(status & (ATA_STATUS_ERR | ATA_STATUS_DF))) {
+                return 1;
+        }
+
+        // DMA misbehaved: reset the channel, stay on PIO from now on, and
+        // retry this chain the slow way.
+        ata_soft_reset(channel);
+        drive->dma = false;
+        device->mode = "pio";
+        return ata_pio_transfer(drive, device->active) == 0 ? 1 : -1;
+}
+
+static int ata_flush(BlockDevice* device)
+{
+        AtaDrive* drive = device->driver_data;
+        const AtaChannel* channel = drive->channel;
+        int status;
+
+        ata_claim_channel(drive);
+
+        if (ata_wait_not_busy(channel) < 0) {
+                return -1;
+        }
+
+        outb(channel->io_base + ATA_REG_DRIVE, (uint8_t)(0xE0 | (drive->slave << 4)));
+        ata_delay(channel);
+        outb(channel->io_base + ATA_REG_COMMAND, ATA_CMD_FLUSH_CACHE);
+        status = ata_wait_not_busy(channel);
+
+        return (status < 0 || (status & (ATA_STATUS_ERR | ATA_STATUS_DF))) ? -1 : 0;
+}
+
+static const BlockOps ata_ops = {
+        .start = ata_start,
+        .poll = ata_poll,
+        .flush = ata_flush,
+};
+
+static bool ata_identify(AtaDrive* drive, uint16_t* identify)
+{
+        const AtaChannel* channel = drive->channel;
+        int status;
+
+        outb(channel->io_base + ATA_REG_DRIVE, (uint8_t)(0xA0 | (drive->slave << 4)));
+        ata_delay(channel);
+        outb(channel->io_base + ATA_REG_SECTOR_COUNT, 0);
+        outb(channel->io_base + ATA_REG_LBA_LOW, 0);
+        outb(channel->io_base + ATA_REG_LBA_MID, 0);
+        outb(channel->io_base + ATA_REG_LBA_HIGH, 0);
+        outb(channel->io_base + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+
+        // 0 means no drive; 0xFF is a floating bus with nothing attached.
+        status = inb(channel->io_base + ATA_REG_STATUS);
+
+        if (status == 0 || status == 0xFF) {
+                return false;
+        }
+
+        if (ata_wait_not_busy(channel) < 0) {
+                return false;
+        }
+
+        // ATAPI and SATA devices abort IDENTIFY and leave a signature here.
+        if (inb(channel->io_base + ATA_REG_LBA_MID) != 0 || inb(channel->io_base + ATA_REG_LBA_HIGH) != 0) {
+                return false;
+        }
+
+        if (ata_wait_drq(channel) < 0) {
+                return false;
+        }
+
+        insw(channel->io_base + ATA_REG_DATA, identify, 256);
+        return true;
+}
+
+static void ata_setup_channels(void)
+{
+        static const uint16_t legacy_io[2] = { 0x1F0, 0x170 };
+        static const uint16_t legacy_control[2] = { 0x3F6, 0x376 };
+        PciDevice controller;
+        bool have_controller = pci_find_class(PCI_CLASS_MASS_STORAGE, PCI_SUBCLASS_IDE, &controller);
+        uint32_t bm_base = 0;
+
+        if (have_controller) {
+                bm_base = pci_read_bar(&controller, 4);
+
+                if (bm_base != 0) {
+                        pci_enable(&controller, PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+                }
+        }
+
+        for (int i = 0; i < 2; ++i) {
+                AtaChannel* channel = &channels[i];
+
+                channel->io_base = legacy_io[i];
+                channel->control_base = legacy_control[i];
+
+                // prog_if bits 0 and 2 select native PCI mode for each channel,
+                // in which case the ports come from BAR0/1 and BAR2/3.
+                if (have_controller && (controller.prog_if & (1 << (i * 2)))) {
+                        uint32_t io = pci_read_bar(&controller, i * 2);
+                        uint32_t control = pci_read_bar(&controller, i * 2 + 1);
+
+                        if (io != 0 && control != 0) {
+                                channel->io_base = (uint16_t)io;
+                                channel->control_base = (uint16_t)(control + 2);
+                        }
+                }
+
+                channel->bm_base = bm_base != 0 ? (uint16_t)(bm_base + i * 8) : 0;
+                channel->prd = prd_tables[i];
+                channel->owner = NULL;
+
+                // There is no IDT yet, so keep INTRQ masked and poll instead.
+                outb(channel->control_base, ATA_CONTROL_NIEN);
+        }
+}
+
+size_t ata_initialize(void)
+{
+        uint16_t identify[256];
+        size_t found = 0;
+
+        ata_setup_channels();
+
+        for (int i = 0; i < 4; ++i) {
+                AtaDrive* drive = &drives[i];
+                BlockDevice* device = &drive->block;
+                uint32_t sectors;
+
+                drive->channel = &channels[i / 2];
+                drive->slave = (uint8_t)(i % 2);
+
+                if (!ata_identify(drive, identify)) {
+                        continue;
+                }
+
+                // Word 49: bit 9 is LBA support, bit 8 is DMA support.
+                if (!(identify[49] & (1 << 9))) {
+                        continue;
+                }
+
+                sectors = (uint32_t)identify[60] | ((uint32_t)identify[61] << 16);
+
+                if (sectors == 0) {
+                        continue;
+                }
+
+                drive->dma = drive->channel->bm_base != 0 && (identify[49] & (1 << 8));
+
+                device->name[0] = 'a';
+                device->name[1] = 't';
+                device->name[2] = 'a';
+                device->name[3] = (char)('0' + i);
+                device->name[4] = '\0';
+                device->sector_count = sectors < ATA_LBA28_LIMIT ? sectors : ATA_LBA28_LIMIT;
+                device->max_sectors = ATA_MAX_SECTORS;
+                device->max_segments = ATA_PRD_ENTRIES / 2;
+                device->mode = drive->dma ? "dma" : "pio";
+                device->ops = &ata_ops;
+                device->driver_data = drive;
+
+                if (block_register(device) == 0) {
+                        ++found;
+                }
+        }
+
+        return found;
+}
@@ -0,0 +1,14 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_DRIVERS_ATA_H
+#define ENZOS_DRIVERS_ATA_H
+
+#include <stddef.h>
+
+/*
+ * Probe both legacy IDE channels and register every ATA disk found with the
+ * block layer as ata0..ata3. Returns the number of disks registered.
+ */
+size_t ata_initialize(void);
+
+#endif /* ENZOS_DRIVERS_ATA_H */
@@ -0,0 +1,267 @@
+#include "block.h"
+#include "libk/string.h"
+
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+static BlockDevice* devices[BLOCK_MAX_DEVICES];
+static size_t device_count = 0;
+
+int block_register(BlockDevice* device)
+{
+        if (!device || !device->ops || device_count >= BLOCK_MAX_DEVICES) {
+                return -1;
+        }
+
+        if (device->max_sectors == 0) {
+                device->max_sectors = 1;
+        }
+
+        if (device->max_segments == 0) {
+                device->max_segments = 1;
+        }
+
+        device->queue = NULL;
+        device->active = NULL;
+        devices[device_count++] = device;
+        return 0;
+}
+
+size_t block_device_count(void)
+{
+        return device_count;
+}
+
+BlockDevice* block_device_at(size_t index)
+{
+        return index < device_count ? devices[index] : NULL;
+}
+
+BlockDevice* block_device_find(const char* name)
+{
+        if (!name) {
+                return NULL;
+        }
+
+        for (size_t i = 0; i < device_count; ++i) {
+                if (strcmp(devices[i]->name, name) == 0) {
+                        return devices[i];
+                }
+        }
+
+        return NULL;
+}
+
+static bool requests_overlap(const BlockRequest* a, const BlockRequest* b)
+{
+        return a->lba < b->lba + b->count && b->lba < a->lba + a->count;
+}
+
+int block_submit(BlockDevice* device, BlockRequest* request)
+{
+        BlockRequest** link;
+        BlockRequest** insert_at;
+
+        if (!device || !request || !request->buffer || request->count == 0
+                || request->count > device->max_sectors || request->lba >= device->sector_count
+                || request->count > device->sector_count - request->lba) {
+                return -1;
+        }
+
+        request->status = BLOCK_PENDING;
+        request->next = NULL;
+        request->merge_next = NULL;
+
+        // Keep the queue sorted by LBA so the dispatcher sweeps the disk in one
+        // direction and sees mergeable neighbours side by side. A request is
+        // never placed ahead of an older one it overlaps, so reads after writes
+        // (and writes after writes) to the same sectors stay ordered.
+        link = &device->queue;
+        insert_at = NULL;
+
+        while (*link) {
+                if (!insert_at && (*link)->lba > request->lba) {
+                        insert_at = link;
+                }
+
+                if (requests_overlap(*link, request)) {
+                        insert_at = NULL;
+                }
+
+                link = &(*link)->next;
+        }
+
+        if (!insert_at) {
+                insert_at = link;
+        }
+
+        request->next = *insert_at;
+        *insert_at = request;
+        ++device->stats.requests;
+
+        block_poll(device);
+        return 0;
+}
+
+static void complete_chain(BlockDevice* device, BlockRequest* chain, int status)
+{
+        while (chain) {
+                BlockRequest* next = chain->merge_next;
+
+                if (status == BLOCK_DONE) {
+                        if (chain->op == BLOCK_WRITE) {
+                                device->stats.sectors_written += chain->count;
+                        } else {
+                                device->stats.sectors_read += chain->count;
+                        }
+                } else {
+                        ++device->stats.errors;
+                }
+
+                chain->next = NULL;
+                chain->merge_next = NULL;
+                chain->status = status;
+                chain = next;
+        }
+}
+
+static void dispatch(BlockDevice* device)
+{
+        BlockRequest* chain = device->queue;
+        BlockRequest* last = chain;
+        uint32_t sectors = chain->count;
+        uint32_t segments = 1;
+        int result;
+
+        // Absorb queued requests that continue exactly where the chain ends.
+        // Their buffers need not be adjacent; the driver scatters the data.
+        while (last->next && last->next->op == chain->op
+                && last->next->lba == last->lba + last->count
+                && sectors + last->next->count <= device->max_sectors
+                && segments < device->max_segments) {
+                last->merge_next = last->next;
+                last = last->next;
+                sectors += last->count;
+                ++segments;
+                ++device->stats.merged;
+        }
+
+        last->merge_next = NULL;
+        device->queue = last->next;
+        ++device->stats.commands;
+
+        result = device->ops->start(device, chain);
+
+        if (result == 0) {
+                device->active = chain;
+                return;
+        }
+
+        complete_chain(device, chain, result > 0 ? BLOCK_DONE : BLOCK_ERROR);
+}
+
+void block_poll(BlockDevice* device)
+{
+        if (!device) {
+                return;
+        }
+
+        if (device->active) {
+                int result = device->ops->poll(device);
+                BlockRequest* chain = device->active;
+
+                if (result == 0) {
+                        return;
+                }
+
+                device->active = NULL;
+                complete_chain(device, chain, result > 0 ? BLOCK_DONE : BLOCK_ERROR);
+        }
+
+        if (device->queue) {
+                dispatch(device);
+        }
+}
+
+int block_wait(BlockDevice* device, BlockRequest* request)
+{
+        if (!device || !request) {
+                return -1;
+        }
+
+        while (request->status == BLOCK_PENDING) {
+                block_poll(device);
+        }
+
+        return request->status == BLOCK_DONE ? 0 : -1;
+}
+
+void block_drain(BlockDevice* device)
+{
+        if (!device) {
+                return;
+        }
+
+        while (device->active || device->queue) {
+                block_poll(device);
+        }
+}
+
+int block_flush(BlockDevice* device)
+{
+        if (!device) {
+                return -1;
+        }
+
+        block_drain(device);
+
+        if (!device->ops->flush) {
+                return 0;
+        }
+
+        return device->ops->flush(device);
+}
+
+static int block_transfer(BlockDevice* device, int op, uint32_t lba, uint32_t count, void* buffer)
+{
+        char* cursor = buffer;
+
+        if (!device || !buffer) {
+                return -1;
+        }
+
+        while (count > 0) {
+                BlockRequest request;
+                uint32_t chunk = count < device->max_sectors ? count : device->max_sectors;
+
+                request.op = op;
+                request.lba = lba;
+                request.count = chunk;
+                request.buffer = cursor;
+
+                if (block_submit(device, &request) != 0 || block_wait(device, &request) != 0) {
+                        return -1;
+                }
+
+                lba += chunk;
+                count -= chunk;
+                cursor += (size_t)chunk * BLOCK_SECTOR_SIZE;
+        }
+
+        return 0;
+}
+
+int block_read(BlockDevice* device, uint32_t lba, uint32_t count, void* buffer)
+{
+        return block_transfer(device, BLOCK_READ, lba, count, buffer);
+}
+
+int block_write(BlockDevice* device, uint32_t lba, uint32_t count, const void* buffer)
+{
+        return block_transfer(device, BLOCK_WRITE, lba, count, (void*)buffer);
+}
@@ -0,0 +1,93 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_DRIVERS_BLOCK_H
+#define ENZOS_DRIVERS_BLOCK_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BLOCK_SECTOR_SIZE 512
+#define BLOCK_MAX_DEVICES 4
+
+#define BLOCK_READ 0
+#define BLOCK_WRITE 1
+
+#define BLOCK_PENDING 0
+#define BLOCK_DONE 1
+#define BLOCK_ERROR -1
+
+/*
+ * One transfer of whole sectors. The caller owns the request and its buffer
+ * until status leaves BLOCK_PENDING. While queued, requests are kept sorted by
+ * LBA, and neighbours with the same direction are chained through merge_next
+ * so the driver can move them with a single command.
+ */
+typedef struct BlockRequest {
+        int op;
+        uint32_t lba;
+        uint32_t count;
+        void* buffer;
+        volatile int status;
+        struct BlockRequest* next;
+        struct BlockRequest* merge_next;
+} BlockRequest;
+
+typedef struct BlockDevice BlockDevice;
+
+typedef struct {
+        /*
+         * Start a merged chain of requests. Returns 0 when the transfer is in
+         * flight, 1 when it already finished (e.g. PIO), -1 on failure.
+         */
+        int (*start)(BlockDevice* device, BlockRequest* chain);
+        /* Returns 0 while busy, 1 once the chain completed, -1 on failure. */
+        int (*poll)(BlockDevice* device);
+        /* Commit the device's volatile write cache. May be NULL. */
+        int (*flush)(BlockDevice* device);
+} BlockOps;
+
+typedef struct {
+        unsigned requests;
+        unsigned merged;
+        unsigned commands;
+        unsigned sectors_read;
+        unsigned sectors_written;
+        unsigned errors;
+} BlockStats;
+
+struct BlockDevice {
+        char name[8];
+        uint32_t sector_count;
+        uint32_t max_sectors;
+        uint32_t max_segments;
+        const char* mode;
+        const BlockOps* ops;
+        void* driver_data;
+        BlockRequest* queue;
+        BlockRequest* active;
+        BlockStats stats;
+};
+
+int block_register(BlockDevice* device);
+size_t block_device_count(void);
+BlockDevice* block_device_at(size_t index);
+BlockDevice* block_device_find(const char* name);
+
+/* Queue a request and return without waiting for it to finish. */
+int block_submit(BlockDevice* device, BlockRequest* request);
+
+/* Advance the device queue: complete the transfer in flight and start the next. */
+void block_poll(BlockDevice* device);
+
+int block_wait(BlockDevice* device, BlockRequest* request);
+void block_drain(BlockDevice* device);
+
+/* Drain the queue, then ask the device to commit its write cache. */
+int block_flush(BlockDevice* device);
+
+/* Synchronous helpers built on submit and wait. */
+int block_read(BlockDevice* device, uint32_t lba, uint32_t count, void* buffer);
+int block_write(BlockDevice* device, uint32_t lba, uint32_t count, const void* buffer);
+
+#endif /* ENZOS_DRIVERS_BLOCK_H */
@@ -0,0 +1,58 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_DRIVERS_IO_H
+#define ENZOS_DRIVERS_IO_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* x86 port I/O helpers shared by the drivers that talk to legacy hardware. */
+
+static inline uint8_t inb(uint16_t port)
+{
+        uint8_t result;
+        __asm__ __volatile__("inb %1, %0" : "=a"(result) : "Nd"(port));
+        return result;
+}
+
+static inline uint16_t inw(uint16_t port)
+{
+        uint16_t result;
+        __asm__ __volatile__("inw %1, %0" : "=a"(result) : "Nd"(port));
+        return result;
+}
+
+static inline uint32_t inl(uint16_t port)
+{
+        uint32_t result;
+        __asm__ __volatile__("inl %1, %0" : "=a"(result) : "Nd"(port));
+        return result;
+}
+
+static inline void outb(uint16_t port, uint8_t value)
+{
+        __asm__ __volatile__("outb %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline void outw(uint16_t port, uint16_t value)
+{
+        __asm__ __volatile__("outw %0, %1" : : "a"(value), "Nd"(port));
+}
+
+static inline void outl(uint16_t port, uint32_t value)
+{
+        __asm__ __volatile__("outl %0, %1" : : "a"(value), "Nd"(port));
+}
+
+/* Move count 16-bit words between a port and memory with rep insw/outsw. */
+static inline void insw(uint16_t port, void* buffer, size_t count)
+{
+        __asm__ __volatile__("rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+static inline void outsw(uint16_t port, const void* buffer, size_t count)
+{
+        __asm__ __volatile__("rep outsw" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+#endif /* ENZOS_DRIVERS_IO_H */
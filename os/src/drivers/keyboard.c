@@ -1,4 +1,5 @@
 #include "keyboard.h"
+#include "io.h"
 
 #if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
 #error "You are not using a cross-compiler, you will most certainly run into trouble"
@@ -13,13 +14,6 @@
 
 static bool shift_pressed = false;
 
-static inline uint8_t inb(uint16_t port)
-{
-        uint8_t result;
-        __asm__ __volatile__("inb %1, %0" : "=a"(result) : "Nd"(port));
-        return result;
-}
-
 static char base_keymap[128] = {
         [0x01] = '\033', /* Escape */
         [0x02] = '1',
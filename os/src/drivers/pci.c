@@ -0,0 +1,113 @@
+#include "pci.h"
+#include "io.h"
+
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+/* Configuration mechanism #1: write an address to 0xCF8, move data via 0xCFC. */
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+#define PCI_MAX_BUSES 256
+#define PCI_MAX_SLOTS 32
+#define PCI_MAX_FUNCTIONS 8
+
+static uint32_t pci_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+        return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)(slot & 0x1F) << 11)
+                | ((uint32_t)(function & 0x07) << 8) | (offset & 0xFC);
+}
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset)
+{
+        outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, function, offset));
+        return inl(PCI_CONFIG_DATA);
+}
+
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value)
+{
+        outl(PCI_CONFIG_ADDRESS, pci_address(bus, slot, function, offset));
+        outl(PCI_CONFIG_DATA, value);
+}
+
+bool pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice* out)
+{
+        for (int bus = 0; bus < PCI_MAX_BUSES; ++bus) {
+                for (int slot = 0; slot < PCI_MAX_SLOTS; ++slot) {
+                        for (int function = 0; function < PCI_MAX_FUNCTIONS; ++function) {
+                                uint32_t id = pci_config_read32(bus, slot, function, 0x00);
+                                uint32_t class_reg;
+
+                                if ((id & 0xFFFF) == 0xFFFF) {
+                                        if (function == 0) {
+                                                break;
+                                        }
+                                        continue;
+                                }
+
+                                class_reg = pci_config_read32(bus, slot, function, 0x08);
+
+                                if ((uint8_t)(class_reg >> 24) == class_code
+                                        && (uint8_t)(class_reg >> 16) == subclass) {
+                                        if (out) {
+                                                out->bus = (uint8_t)bus;
+                                                out->slot = (uint8_t)slot;
+                                                out->function = (uint8_t)function;
+                                                out->vendor_id = (uint16_t)(id & 0xFFFF);
+                                                out->device_id = (uint16_t)(id >> 16);
+                                                out->class_code = class_code;
+                                                out->subclass = subclass;
+                                                out->prog_if = (uint8_t)(class_reg >> 8);
+                                        }
+                                        return true;
+                                }
+
+                                // Single-function devices leave the multifunction bit clear.
+                                if (function == 0
+                                        && !(pci_config_read32(bus, slot, 0, 0x0C) & 0x00800000u)) {
+                                        break;
+                                }
+                        }
+                }
+        }
+
+        return false;
+}
+
+uint32_t pci_read_bar(const PciDevice* device, int index)
+{
+        uint32_t bar;
+
+        if (!device || index < 0 || index > 5) {
+                return 0;
+        }
+
+        bar = pci_config_read32(device->bus, device->slot, device->function, (uint8_t)(0x10 + index * 4));
+
+        // Bit 0 set means an I/O space BAR; the low two bits are flags.
+        if (bar & 0x1) {
+                return bar & ~0x3u;
+        }
+
+        return bar & ~0xFu;
+}
+
+void pci_enable(const PciDevice* device, uint16_t command_bits)
+{
+        uint32_t reg;
+
+        if (!device) {
+                return;
+        }
+
+        // Command is the low half of offset 0x04; the status half is
+        // write-one-to-clear, so write zeros there.
+        reg = pci_config_read32(device->bus, device->slot, device->function, 0x04);
+        reg = (reg & 0xFFFF) | command_bits;
+        pci_config_write32(device->bus, device->slot, device->function, 0x04, reg);
+}
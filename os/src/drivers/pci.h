@@ -0,0 +1,37 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_DRIVERS_PCI_H
+#define ENZOS_DRIVERS_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#define PCI_CLASS_MASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_BUS_MASTER 0x0004
+
+typedef struct {
+        uint8_t bus;
+        uint8_t slot;
+        uint8_t function;
+        uint16_t vendor_id;
+        uint16_t device_id;
+        uint8_t class_code;
+        uint8_t subclass;
+        uint8_t prog_if;
+} PciDevice;
+
+uint32_t pci_config_read32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset);
+void pci_config_write32(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value);
+
+/* Scan every bus for the first function with the given class and subclass. */
+bool pci_find_class(uint8_t class_code, uint8_t subclass, PciDevice* out);
+
+/* Read a base address register (0-5), masked down to its address bits. */
+uint32_t pci_read_bar(const PciDevice* device, int index);
+
+void pci_enable(const PciDevice* device, uint16_t command_bits);
+
+#endif /* ENZOS_DRIVERS_PCI_H */
@@ -1,5 +1,9 @@
 #include <stddef.h>
+#include <stdint.h>
 #include "fs.h"
+#include "libk/string.h"
+#include "mm/kmalloc.h"
+#include "mm/pmm.h"
 
 /* Check if the compiler thinks you are targeting the wrong operating system. */
 #if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
@@ -11,483 +15,2271 @@
 #error "This tutorial needs to be compiled with a ix86-elf compiler"
 #endif
 
-#define FS_MAX_NODES 128
-#define FS_CONTENT_POOL_SIZE 4096
+#define FS_NAME_SETS 64     /* power of two */
+#define FS_TRIGRAM_SETS 128 /* power of two */
+#define FS_CONTENT_POOL_SIZE 4096    /* static pool used until the heap is needed */
+#define FS_CONTENT_POOL_MAX (4u << 20) /* largest buddy block */
+#define FS_HASH_BUCKETS 256 /* power of two, keeps chains short at full pool */
+#define FS_DCACHE_SLOTS 64   /* power of two */
+#define FS_DCACHE_PATH_MAX 96
+#define FS_MAX_OPEN_FILES 16
+
+/*
+ * Nodes live in chunks of one frame each, taken from kmalloc as the tree
+ * grows. kmalloc hands out frame-sized requests frame-aligned, so a node
+ * finds its chunk header by masking its own address. Every node has a slot
+ * number, chunk index * NODE_CHUNK_SLOTS + position, that keys the name
+ * index bitmaps below; NODE_CHUNK_SLOTS is a power of two so the split is a
+ * shift. Chunks are never freed before fs_init, so slots and node addresses
+ * stay fixed. The last chunk is carved up to node_chunk_used, and removed
+ * nodes are pushed onto node_free_list (threaded through next_sibling) so
+ * later creates reuse them before touching fresh slots.
+ */
+#define NODE_CHUNK_SHIFT 6
+#define NODE_CHUNK_SLOTS (1u << NODE_CHUNK_SHIFT)
+
+typedef struct NodeChunk {
+        size_t index;
+        FSNode nodes[] __attribute__((aligned(64)));
+} NodeChunk;
+
+#define NODES_PER_CHUNK ((PMM_FRAME_SIZE - sizeof(NodeChunk)) / sizeof(FSNode))
+
+typedef char fs_node_chunk_fits_slots[NODES_PER_CHUNK <= NODE_CHUNK_SLOTS ? 1 : -1];
+
+static NodeChunk** node_chunks = NULL;
+static size_t node_chunk_count = 0;
+static size_t node_chunk_capacity = 0;
+static size_t node_chunk_used = 0;
+static FSNode* node_free_list = NULL;
+static FSNode root_node;
+static FSNodeRef current_working_directory;
+
+/* The layout promise in fs.h: one node per cache line on the 32-bit target. */
+typedef char fs_node_fits_cache_line[sizeof(void*) != 4 || sizeof(FSNode) == 64 ? 1 : -1];
+
+/*
+ * Directory storage comes from the kernel heap, so files never pay for child
+ * storage and the number of directories is only bounded by memory.
+ */
+static FSDir root_dir;
+
+/*
+ * Names of FS_INLINE_NAME bytes or more live on the heap, reference counted
+ * and shared between nodes with the same name (copies, the same file name in
+ * several directories), so the node only holds a pointer. name_storable
+ * allocates spare_long_name ahead of time so that creating or renaming a node
+ * cannot fail halfway through.
+ */
+typedef struct LongName {
+        struct LongName* next;
+        unsigned int refs;
+        unsigned int hash;
+        char text[FS_NAME_MAX + 1];
+} LongName;
+
+static LongName* long_names = NULL;
+static LongName* spare_long_name = NULL;
+static size_t long_names_live = 0;
+
+/*
+ * Global name index over the node slots, one bit per slot in each set: a
+ * live set, name sets picked by the hash of the whole name and trigram sets
+ * picked by a hash of every three-character run in it. fs_find intersects the sets a
+ * pattern implies and only compares the names that survive. Shared buckets
+ * can add candidates but never lose one, and a node's bits are cleared from
+ * the same buckets its name set them in, so removal stays exact.
+ */
+#define NODE_SETS (1 + FS_NAME_SETS + FS_TRIGRAM_SETS)
+#define LIVE_SET 0
+#define NAME_SET(hash) (1 + ((hash) & (FS_NAME_SETS - 1)))
+#define TRIGRAM_SET(bucket) (1 + FS_NAME_SETS + (bucket))
+
+/*
+ * All NODE_SETS sets share one heap block, node_set_width words apiece, and
+ * cover every slot of node_chunk_capacity chunks. The block is reallocated
+ * whenever the chunk table grows.
+ */
+static unsigned int* node_set_words = NULL;
+static size_t node_set_width = 0;
+
+static unsigned int* node_set(size_t index)
+{
+        return node_set_words + index * node_set_width;
+}
+
+// Nodes carved so far in chunk c.
+static size_t chunk_carved(size_t c)
+{
+        return c + 1 == node_chunk_count ? node_chunk_used : NODES_PER_CHUNK;
+}
+
+static FSNode* node_at(size_t slot)
+{
+        return &node_chunks[slot >> NODE_CHUNK_SHIFT]->nodes[slot & (NODE_CHUNK_SLOTS - 1)];
+}
+
+static size_t node_slot(const FSNode* node)
+{
+        const NodeChunk* chunk = (const NodeChunk*)((uintptr_t)node & ~(uintptr_t)(PMM_FRAME_SIZE - 1));
+
+        return (chunk->index << NODE_CHUNK_SHIFT) | (size_t)(node - chunk->nodes);
+}
+
+/*
+ * File contents live in content_pool as [ContentBlock header][payload] runs.
+ * A block is reference counted so copies can share it until one side writes.
+ * Freed blocks go onto segregated free lists (class k holds payloads of at
+ * least CONTENT_MIN_PAYLOAD << k bytes); the region above content_pool_used
+ * has never been carved. When neither satisfies a request but enough bytes
+ * are dead, compact_content slides live blocks down and patches every file
+ * that points at them. When too few bytes are dead, the pool is compacted
+ * into a heap block twice the size instead; it starts in a static array so
+ * the filesystem works before (and without) the heap.
+ */
+#define CONTENT_ALIGN 8
+#define CONTENT_MIN_PAYLOAD 8
+#define CONTENT_CLASSES 10
+
+typedef struct {
+        size_t capacity;  // payload bytes available after the header
+        unsigned int refs; // files sharing the payload; 0 while on a free list
+        char* forward;    // new payload address, only meaningful while compacting
+} ContentBlock;
+
+static char content_pool_static[FS_CONTENT_POOL_SIZE] __attribute__((aligned(CONTENT_ALIGN)));
+static char* content_pool = content_pool_static;
+static size_t content_pool_size = FS_CONTENT_POOL_SIZE;
+static size_t content_pool_used = 0;
+static ContentBlock* content_free_lists[CONTENT_CLASSES];
+static size_t content_free_bytes = 0; // headers included, excludes the uncarved tail
+
+/*
+ * Directory entry index: every non-root node is chained into the bucket picked
+ * by its (parent, name) pair, so fs_lookup only compares names whose hash
+ * already matches instead of scanning every child of the directory.
+ */
+static FSNode* dentry_buckets[FS_HASH_BUCKETS];
+
+/*
+ * Path cache: maps (start directory, normalized path) to the node the walk
+ * ended on, or records the directory where it failed. Results and failure
+ * points are held as FSNodeRef, so removals invalidate entries lazily through
+ * the generation check. Creating a name in a directory drops the misses that
+ * stopped there, and moving a node drops every entry whose walk crossed it.
+ * Paths containing ".." are never cached because they depend on nodes that
+ * are not on the path from start to result.
+ */
+typedef struct {
+        FSNodeRef start;
+        FSNodeRef result; // result.node is NULL for a cached miss
+        FSNodeRef stop;   // for misses: node whose lookup failed
+        unsigned int hash;
+        size_t path_len;
+        char path[FS_DCACHE_PATH_MAX];
+} DcacheEntry;
+
+static DcacheEntry dcache[FS_DCACHE_SLOTS];
+
+typedef struct {
+        FSNodeRef file; // file.node is NULL while the slot is free
+        size_t offset;
+        int flags;
+} FSHandle;
+
+static FSHandle open_files[FS_MAX_OPEN_FILES];
+
+// Operation counters and high-water marks; fs_get_stats adds current usage.
+static FSStats stats;
+static size_t nodes_live = 0;
+static size_t dirs_live = 0;
+
+static ContentBlock* content_header(const char* payload)
+{
+        return (ContentBlock*)(payload - sizeof(ContentBlock));
+}
+
+static char* content_payload(ContentBlock* block)
+{
+        return (char*)(block + 1);
+}
+
+static int content_in_pool(const char* payload)
+{
+        return payload >= content_pool && payload < content_pool + content_pool_size;
+}
+
+// Free blocks keep the next pointer of their list in the first payload bytes.
+static ContentBlock** content_next(ContentBlock* block)
+{
+        return (ContentBlock**)content_payload(block);
+}
+
+static size_t content_class(size_t capacity)
+{
+        size_t cls = 0;
+
+        while (cls + 1 < CONTENT_CLASSES && (size_t)(CONTENT_MIN_PAYLOAD << (cls + 1)) <= capacity) {
+                ++cls;
+        }
+
+        return cls;
+}
+
+static void content_push_free(ContentBlock* block)
+{
+        size_t cls = content_class(block->capacity);
+
+        block->refs = 0;
+        *content_next(block) = content_free_lists[cls];
+        content_free_lists[cls] = block;
+        content_free_bytes += sizeof(ContentBlock) + block->capacity;
+}
+
+static ContentBlock* content_take_free(size_t capacity)
+{
+        for (size_t cls = content_class(capacity); cls < CONTENT_CLASSES; ++cls) {
+                ContentBlock** link = &content_free_lists[cls];
+
+                while (*link) {
+                        ContentBlock* block = *link;
+
+                        if (block->capacity >= capacity) {
+                                *link = *content_next(block);
+                                content_free_bytes -= sizeof(ContentBlock) + block->capacity;
+                                return block;
+                        }
+
+                        link = content_next(block);
+                }
+        }
+
+        return NULL;
+}
+
+/*
+ * Slide every live block towards the start of target, which is either the
+ * pool itself or a larger replacement of size target_size. Shared blocks have
+ * no single owner, so this works in three passes: record each block's new
+ * address in its header, repoint every file node, then move the bytes. `pin`
+ * lets a caller keep a pointer into some block's payload (for example the
+ * source of a copy) valid across the move.
+ */
+static void compact_content(char* target, size_t target_size, const char** pin)
+{
+        size_t read = 0;
+        size_t write = 0;
+
+        while (read < content_pool_used) {
+                ContentBlock* block = (ContentBlock*)&content_pool[read];
+                size_t span = sizeof(ContentBlock) + block->capacity;
+
+                if (block->refs > 0) {
+                        char* payload = content_payload(block);
+
+                        block->forward = content_payload((ContentBlock*)&target[write]);
+
+                        if (pin && *pin >= payload && *pin < payload + block->capacity) {
+                                *pin = block->forward + (*pin - payload);
+                        }
+
+                        write += span;
+                }
+
+                read += span;
+        }
+
+        for (size_t c = 0; c < node_chunk_count; ++c) {
+                for (size_t i = 0; i < chunk_carved(c); ++i) {
+                        FSNode* node = &node_chunks[c]->nodes[i];
+
+                        if (node->type == NODE_FILE && content_in_pool(node->content)) {
+                                node->content = content_header(node->content)->forward;
+                        }
+                }
+        }
+
+        read = 0;
+        while (read < content_pool_used) {
+                ContentBlock* block = (ContentBlock*)&content_pool[read];
+                size_t span = sizeof(ContentBlock) + block->capacity;
+
+                if (block->refs > 0) {
+                        memmove(content_header(block->forward), block, span);
+                }
+
+                read += span;
+        }
+
+        for (size_t i = 0; i < CONTENT_CLASSES; ++i) {
+                content_free_lists[i] = NULL;
+        }
+
+        if (target != content_pool) {
+                if (content_pool != content_pool_static) {
+                        kfree(content_pool);
+                }
+
+                content_pool = target;
+                content_pool_size = target_size;
+        }
+
+        content_pool_used = write;
+        content_free_bytes = 0;
+}
+
+/*
+ * Move the pool into a heap block large enough for span more bytes on top of
+ * the live ones. Returns -1 if the heap cannot supply one.
+ */
+static int grow_content(size_t span, const char** pin)
+{
+        size_t needed = content_pool_used - content_free_bytes + span;
+        size_t size = content_pool_size * 2;
+        char* pool;
+
+        while (size < needed && size < FS_CONTENT_POOL_MAX) {
+                size *= 2;
+        }
+
+        if (size < needed || size > FS_CONTENT_POOL_MAX) {
+                return -1;
+        }
+
+        pool = kmalloc(size);
+
+        if (!pool) {
+                return -1;
+        }
+
+        compact_content(pool, size, pin);
+        return 0;
+}
+
+static char* content_alloc(size_t size, const char** pin)
+{
+        size_t capacity = (size + CONTENT_ALIGN - 1) & ~(size_t)(CONTENT_ALIGN - 1);
+        size_t span;
+        ContentBlock* block;
+
+        if (capacity < CONTENT_MIN_PAYLOAD) {
+                capacity = CONTENT_MIN_PAYLOAD;
+        }
+
+        span = sizeof(ContentBlock) + capacity;
+        block = content_take_free(capacity);
+
+        if (block) {
+                if (block->capacity - capacity >= sizeof(ContentBlock) + CONTENT_MIN_PAYLOAD) {
+                        ContentBlock* rest = (ContentBlock*)(content_payload(block) + capacity);
+
+                        rest->capacity = block->capacity - span;
+                        content_push_free(rest);
+                        block->capacity = capacity;
+                }
+        } else {
+                if (span > content_pool_size - content_pool_used) {
+                        if (span <= content_pool_size - content_pool_used + content_free_bytes) {
+                                compact_content(content_pool, content_pool_size, pin);
+                        } else if (grow_content(span, pin) != 0) {
+                                return NULL;
+                        }
+
+                        stats.compactions++;
+                }
+
+                block = (ContentBlock*)&content_pool[content_pool_used];
+                block->capacity = capacity;
+                content_pool_used += span;
+                if (content_pool_used > stats.content_peak) {
+                        stats.content_peak = content_pool_used;
+                }
+        }
+
+        block->refs = 1;
+        return content_payload(block);
+}
+
+// Drop one reference; the block is reclaimed when the last sharer lets go.
+static void content_release(char* payload)
+{
+        ContentBlock* block;
+
+        if (!content_in_pool(payload)) {
+                return;
+        }
+
+        block = content_header(payload);
+        if (--block->refs > 0) {
+                return;
+        }
+
+        // The top block simply gives its bytes back to the uncarved tail.
+        if (payload + block->capacity == &content_pool[content_pool_used]) {
+                content_pool_used -= sizeof(ContentBlock) + block->capacity;
+                return;
+        }
+
+        content_push_free(block);
+}
+
+static size_t content_capacity(const char* payload)
+{
+        return content_in_pool(payload) ? content_header(payload)->capacity : 0;
+}
+
+// Only a file that is the sole user of its block may modify it in place.
+static int content_writable(const char* payload)
+{
+        return content_in_pool(payload) && content_header(payload)->refs == 1;
+}
+
+/*
+ * Replace a file's bytes with data[0..len). Rewrites reuse the allocation in
+ * place unless it is shared or would sit mostly empty, so a file that once
+ * grew large does not pin that space. data may point into the file's own or
+ * another file's contents.
+ */
+static int replace_content(FSNode* file, const char* data, size_t len)
+{
+        size_t capacity = content_capacity(file->content);
+        char* content;
+
+        if (content_writable(file->content) && len + 1 <= capacity && (len + 1) * 4 > capacity) {
+                memmove(file->content, data, len);
+                file->content[len] = '\0';
+                file->size = len;
+                file->flags |= FS_NODE_DIRTY_DATA;
+                return 0;
+        }
+
+        content = content_alloc(len + 1, &data);
+        if (!content) {
+                return -1;
+        }
+
+        memmove(content, data, len);
+        content[len] = '\0';
+        content_release(file->content);
+        file->content = content;
+        file->size = len;
+        file->flags |= FS_NODE_DIRTY_DATA;
+
+        return 0;
+}
+
+/*
+ * Make `file` share `src`'s contents instead of copying them. The first write
+ * to either side gives that side a private copy.
+ */
+static void share_content(FSNode* file, FSNode* src)
+{
+        if (file->content == src->content) {
+                return;
+        }
+
+        if (content_in_pool(src->content)) {
+                content_header(src->content)->refs++;
+        }
+
+        content_release(file->content);
+        file->content = src->content;
+        file->size = src->size;
+        file->flags |= FS_NODE_DIRTY_DATA;
+}
+
+/*
+ * Make room for `needed` bytes (trailing NUL included) in a block this file
+ * owns alone, keeping the current contents. Growth is geometric so a run of
+ * appends copies each byte O(1) times on average; it falls back to an exact
+ * fit when the pool is tight. Compaction may move both the old contents and
+ * *pin; compact_content patches file->content itself and rebases the pinned
+ * pointer.
+ */
+static int reserve_content(FSNode* file, size_t needed, const char** pin)
+{
+        size_t capacity = content_capacity(file->content);
+        char* content = NULL;
+
+        if (needed < file->size + 1) {
+                needed = file->size + 1;
+        }
+
+        if (content_writable(file->content) && needed <= capacity) {
+                return 0;
+        }
+
+        if (capacity * 2 > needed) {
+                content = content_alloc(capacity * 2, pin);
+        }
+
+        if (!content) {
+                content = content_alloc(needed, pin);
+        }
+
+        if (!content) {
+                return -1;
+        }
+
+        if (file->content) {
+                memmove(content, file->content, file->size);
+        }
+
+        content[file->size] = '\0';
+        content_release(file->content);
+        file->content = content;
+
+        return 0;
+}
+
+static size_t dentry_bucket(const FSNode* parent, unsigned int name_hash)
+{
+        unsigned int mix = (unsigned int)((size_t)parent >> 4) * 2654435761u;
+
+        return (size_t)((mix ^ name_hash) & (FS_HASH_BUCKETS - 1));
+}
+
+static void dentry_insert(FSNode* node)
+{
+        size_t bucket = dentry_bucket(node->parent, node->name_hash);
+
+        node->hash_next = dentry_buckets[bucket];
+        dentry_buckets[bucket] = node;
+}
+
+static void dentry_remove(FSNode* node)
+{
+        FSNode** link = &dentry_buckets[dentry_bucket(node->parent, node->name_hash)];
+
+        while (*link) {
+                if (*link == node) {
+                        *link = node->hash_next;
+                        node->hash_next = NULL;
+                        return;
+                }
+                link = &(*link)->hash_next;
+        }
+}
+
+/*
+ * Per-directory ordered index: a treap over the children keyed by name, with
+ * the name hash as heap priority so its shape is deterministic but balanced
+ * in expectation. The sibling list stays the iteration order; the treap only
+ * tells add_child which neighbour a new entry goes next to. Equal names (the
+ * low-level create calls do not reject duplicates) are ordered by address so
+ * every node has a unique place.
+ */
+static int index_compare(const FSNode* a, const FSNode* b)
+{
+        int order = strcmp(fs_name(a), fs_name(b));
+
+        if (order != 0) {
+                return order;
+        }
+
+        return a < b ? -1 : (a > b ? 1 : 0);
+}
+
+static void index_split(FSNode* tree, const FSNode* key, FSNode** left, FSNode** right)
+{
+        if (!tree) {
+                *left = NULL;
+                *right = NULL;
+                return;
+        }
+
+        if (index_compare(tree, key) < 0) {
+                index_split(tree->index_right, key, &tree->index_right, right);
+                *left = tree;
+        } else {
+                index_split(tree->index_left, key, left, &tree->index_left);
+                *right = tree;
+        }
+}
+
+static FSNode* index_merge(FSNode* left, FSNode* right)
+{
+        if (!left || !right) {
+                return left ? left : right;
+        }
+
+        if (left->name_hash >= right->name_hash) {
+                left->index_right = index_merge(left->index_right, right);
+                return left;
+        }
+
+        right->index_left = index_merge(left, right->index_left);
+        return right;
+}
+
+static FSNode* index_insert(FSNode* tree, FSNode* node)
+{
+        if (!tree) {
+                return node;
+        }
+
+        if (node->name_hash > tree->name_hash) {
+                index_split(tree, node, &node->index_left, &node->index_right);
+                return node;
+        }
+
+        if (index_compare(node, tree) < 0) {
+                tree->index_left = index_insert(tree->index_left, node);
+        } else {
+                tree->index_right = index_insert(tree->index_right, node);
+        }
+
+        return tree;
+}
+
+static FSNode* index_remove(FSNode* tree, FSNode* node)
+{
+        int order;
+
+        if (!tree) {
+                return NULL;
+        }
+
+        if (tree == node) {
+                FSNode* merged = index_merge(node->index_left, node->index_right);
+
+                node->index_left = NULL;
+                node->index_right = NULL;
+                return merged;
+        }
+
+        order = index_compare(node, tree);
+        if (order < 0) {
+                tree->index_left = index_remove(tree->index_left, node);
+        } else {
+                tree->index_right = index_remove(tree->index_right, node);
+        }
+
+        return tree;
+}
+
+/* The child that would follow node in name order, or NULL if it goes last. */
+static FSNode* index_successor(const FSNode* dir, const FSNode* node)
+{
+        FSNode* successor = NULL;
+
+        for (FSNode* tree = dir->dir->index_root; tree;) {
+                if (index_compare(node, tree) < 0) {
+                        successor = tree;
+                        tree = tree->index_left;
+                } else {
+                        tree = tree->index_right;
+                }
+        }
+
+        return successor;
+}
+
+const char* fs_name(const FSNode* node)
+{
+        if (!node) {
+                return NULL;
+        }
+
+        return node->name_len < FS_INLINE_NAME ? node->inline_name : node->long_name;
+}
+
+FSNode* fs_first_child(const FSNode* dir)
+{
+        return dir && dir->type == NODE_DIR ? dir->dir->first_child : NULL;
+}
+
+static unsigned int hash_bytes(const char* name, size_t len)
+{
+        unsigned int hash = 2166136261u;
+
+        for (size_t i = 0; i < len; ++i) {
+                hash ^= (unsigned char)name[i];
+                hash *= 16777619u;
+        }
+
+        return hash;
+}
+
+static LongName* long_name_find(const char* name, size_t len, unsigned int hash)
+{
+        for (LongName* entry = long_names; entry; entry = entry->next) {
+                if (entry->hash != hash) {
+                        continue;
+                }
+
+                if (memcmp(entry->text, name, len) == 0 && entry->text[len] == '\0') {
+                        return entry;
+                }
+        }
+
+        return NULL;
+}
+
+static LongName* long_name_acquire(const char* name, size_t len, unsigned int hash)
+{
+        LongName* entry = long_name_find(name, len, hash);
+
+        if (!entry) {
+                entry = spare_long_name ? spare_long_name : kmalloc(sizeof(LongName));
+                spare_long_name = NULL;
+
+                if (!entry) {
+                        return NULL;
+                }
+
+                strlcpy(entry->text, name, len + 1);
+                entry->hash = hash;
+                entry->refs = 0;
+                entry->next = long_names;
+                long_names = entry;
+                long_names_live++;
+        }
+
+        entry->refs++;
+        return entry;
+}
+
+static void long_name_release(FSNode* node)
+{
+        LongName* entry;
+
+        if (node->name_len < FS_INLINE_NAME) {
+                return;
+        }
+
+        entry = (LongName*)(node->long_name - offsetof(LongName, text));
+        node->name_len = 0;
+        node->inline_name[0] = '\0';
+
+        if (--entry->refs > 0) {
+                return;
+        }
+
+        for (LongName** link = &long_names; *link; link = &(*link)->next) {
+                if (*link == entry) {
+                        *link = entry->next;
+                        break;
+                }
+        }
+
+        long_names_live--;
+
+        // Keep one entry back for the next name_storable.
+        if (!spare_long_name) {
+                spare_long_name = entry;
+        } else {
+                kfree(entry);
+        }
+}
+
+/* Whether set_node_name can store name without running out of memory. */
+static int name_storable(const char* name)
+{
+        size_t len = strnlen(name, FS_NAME_MAX);
+
+        if (len < FS_INLINE_NAME || spare_long_name || long_name_find(name, len, hash_bytes(name, len))) {
+                return 1;
+        }
+
+        spare_long_name = kmalloc(sizeof(LongName));
+        return spare_long_name != NULL;
+}
+
+static int set_node_name(FSNode* node, const char* name)
+{
+        size_t len = strnlen(name, FS_NAME_MAX);
+        unsigned int hash = hash_bytes(name, len);
+        LongName* entry = NULL;
+
+        // Take the new reference first so renaming to the same long name
+        // cannot free the slot underneath itself.
+        if (len >= FS_INLINE_NAME) {
+                entry = long_name_acquire(name, len, hash);
+                if (!entry) {
+                        return -1;
+                }
+        }
+
+        long_name_release(node);
+
+        if (entry) {
+                node->long_name = entry->text;
+        } else {
+                strlcpy(node->inline_name, name, len + 1);
+        }
+
+        node->name_len = (unsigned char)len;
+        node->name_hash = hash;
+        return 0;
+}
+
+static void node_set_assign(unsigned int* set, size_t slot, int present)
+{
+        unsigned int bit = 1u << (slot % 32);
+
+        if (present) {
+                set[slot / 32] |= bit;
+        } else {
+                set[slot / 32] &= ~bit;
+        }
+}
+
+static int node_set_has(const unsigned int* set, size_t slot)
+{
+        return (set[slot / 32] >> (slot % 32)) & 1u;
+}
+
+static void node_set_intersect(unsigned int* set, const unsigned int* other)
+{
+        for (size_t i = 0; i < node_set_width; ++i) {
+                set[i] &= other[i];
+        }
+}
+
+static size_t trigram_bucket(const char* text)
+{
+        unsigned int mix = ((unsigned char)text[0] << 16) | ((unsigned char)text[1] << 8) | (unsigned char)text[2];
+
+        mix *= 2654435761u;
+        return (size_t)(mix >> 16) & (FS_TRIGRAM_SETS - 1);
+}
+
+/* Add (present != 0) or drop a node's entries in the global name index. */
+static void name_index_update(FSNode* node, int present)
+{
+        size_t slot;
+        const char* name;
+
+        if (node == &root_node) {
+                return;
+        }
+
+        slot = node_slot(node);
+        name = fs_name(node);
+
+        node_set_assign(node_set(LIVE_SET), slot, present);
+        node_set_assign(node_set(NAME_SET(node->name_hash)), slot, present);
+
+        for (size_t i = 0; i + 2 < node->name_len; ++i) {
+                node_set_assign(node_set(TRIGRAM_SET(trigram_bucket(name + i))), slot, present);
+        }
+}
+
+/*
+ * Make room for another node chunk, doubling the chunk table and the index
+ * bitmaps when they are full. Returns -1, changing nothing, if the heap
+ * cannot supply the memory.
+ */
+static int add_node_chunk(void)
+{
+        NodeChunk* chunk;
+
+        if (node_chunk_count == node_chunk_capacity) {
+                size_t capacity = node_chunk_capacity ? node_chunk_capacity * 2 : 4;
+                size_t width = capacity * NODE_CHUNK_SLOTS / 32;
+                NodeChunk** chunks = kmalloc(capacity * sizeof(*chunks));
+                unsigned int* words = kmalloc(NODE_SETS * width * sizeof(*words));
+
+                if (!chunks || !words) {
+                        kfree(chunks);
+                        kfree(words);
+                        return -1;
+                }
+
+                if (node_chunk_count > 0) {
+                        memcpy(chunks, node_chunks, node_chunk_count * sizeof(*chunks));
+                }
+
+                for (size_t i = 0; i < NODE_SETS; ++i) {
+                        unsigned int* set = words + i * width;
+
+                        if (node_set_width > 0) {
+                                memcpy(set, node_set(i), node_set_width * sizeof(*set));
+                        }
+                        memset(set + node_set_width, 0, (width - node_set_width) * sizeof(*set));
+                }
+
+                kfree(node_chunks);
+                kfree(node_set_words);
+                node_chunks = chunks;
+                node_chunk_capacity = capacity;
+                node_set_words = words;
+                node_set_width = width;
+        }
+
+        chunk = kmalloc(PMM_FRAME_SIZE);
+
+        if (!chunk) {
+                return -1;
+        }
+
+        chunk->index = node_chunk_count;
+        node_chunks[node_chunk_count++] = chunk;
+        node_chunk_used = 0;
+        return 0;
+}
+
+static FSDir* allocate_dir(void)
+{
+        FSDir* dir = kmalloc(sizeof(FSDir));
+
+        if (!dir) {
+                return NULL;
+        }
+
+        dir->first_child = NULL;
+        dir->last_child = NULL;
+        dir->index_root = NULL;
+        dir->child_count = 0;
+
+        if (++dirs_live > stats.dirs_peak) {
+                stats.dirs_peak = dirs_live;
+        }
+
+        return dir;
+}
+
+static void release_dir(FSDir* dir)
+{
+        if (!dir || dir == &root_dir) {
+                return;
+        }
+
+        kfree(dir);
+        dirs_live--;
+}
+
+static FSNode* allocate_node(NodeType type, const char* name, FSNode* parent)
+{
+	FSNode* node;
+	FSDir* dir = NULL;
+
+	if (!name_storable(name)) {
+		return NULL;
+	}
+
+	if (type == NODE_DIR) {
+		dir = allocate_dir();
+		if (!dir) {
+			return NULL;
+		}
+	}
+
+	if (node_free_list) {
+		node = node_free_list;
+		node_free_list = node->next_sibling;
+	} else if ((node_chunk_count > 0 && node_chunk_used < NODES_PER_CHUNK) || add_node_chunk() == 0) {
+		node = &node_chunks[node_chunk_count - 1]->nodes[node_chunk_used++];
+		node->name_len = 0;
+	} else {
+		release_dir(dir);
+		return NULL;
+	}
+
+	set_node_name(node, name);
+	node->hash_next = NULL;
+	node->type = (unsigned char)type;
+	node->parent = parent;
+	node->prev_sibling = NULL;
+	node->next_sibling = NULL;
+	node->index_left = NULL;
+	node->index_right = NULL;
+	if (dir) {
+		node->dir = dir;
+	} else {
+		node->content = NULL;
+	}
+	node->size = 0;
+	node->flags = FS_NODE_DIRTY | FS_NODE_DIRTY_DATA;
+	node->ino = 0;
+	name_index_update(node, 1);
+
+	stats.creates++;
+	if (++nodes_live > stats.nodes_peak) {
+		stats.nodes_peak = nodes_live;
+	}
+
+	return node;
+}
+
+/*
+ * Bumping the generation is what makes every FSNodeRef to this slot stale,
+ * so it must happen before the slot can be handed out again.
+ */
+static void release_node(FSNode* node)
+{
+        if (!node || node == &root_node) {
+                return;
+        }
+
+        node->generation++;
+        node->parent = NULL;
+        node->prev_sibling = NULL;
+        name_index_update(node, 0);
+        long_name_release(node);
+
+        if (node->type == NODE_DIR) {
+                release_dir(node->dir);
+                node->dir = NULL;
+        } else {
+                content_release(node->content);
+                node->content = NULL;
+        }
+
+        node->size = 0;
+        node->next_sibling = node_free_list;
+        node_free_list = node;
+        nodes_live--;
+        stats.removes++;
+}
+
+FSNodeRef fs_ref(FSNode* node)
+{
+        FSNodeRef ref;
+
+        ref.node = node;
+        ref.generation = node ? node->generation : 0;
+
+        return ref;
+}
+
+FSNode* fs_ref_get(FSNodeRef ref)
+{
+        if (!ref.node || ref.node->generation != ref.generation) {
+                return NULL;
+        }
+
+        return ref.node;
+}
+
+static void dcache_clear(void)
+{
+        for (size_t i = 0; i < FS_DCACHE_SLOTS; ++i) {
+                dcache[i].start.node = NULL;
+        }
+}
+
+static int node_within(const FSNode* node, const FSNode* ancestor)
+{
+        while (node) {
+                if (node == ancestor) {
+                        return 1;
+                }
+                node = node->parent;
+        }
+
+        return 0;
+}
+
+// A name appeared in dir: lookups that failed there may now succeed.
+static void dcache_note_create(FSNode* dir)
+{
+        for (size_t i = 0; i < FS_DCACHE_SLOTS; ++i) {
+                DcacheEntry* entry = &dcache[i];
+
+                if (entry->start.node && !entry->result.node && entry->stop.node == dir) {
+                        entry->start.node = NULL;
+                }
+        }
+}
+
+// node is about to be relinked: forget every walk that went through it.
+static void dcache_note_move(FSNode* node)
+{
+        for (size_t i = 0; i < FS_DCACHE_SLOTS; ++i) {
+                DcacheEntry* entry = &dcache[i];
+                FSNode* end;
+
+                if (!entry->start.node) {
+                        continue;
+                }
+
+                end = entry->result.node ? entry->result.node : entry->stop.node;
+
+                if (node_within(end, node) && !node_within(entry->start.node, node)) {
+                        entry->start.node = NULL;
+                }
+        }
+}
+
+/*
+ * Copy path[0..len) into key with empty and "." segments dropped and each
+ * segment clipped to the stored name length. Returns 0 when the path cannot
+ * be cached (it uses ".." or is too long).
+ */
+static int normalize_path(const char* path, size_t len, char* key, size_t* key_len)
+{
+        size_t i = 0;
+        size_t out = 0;
+
+        while (i < len) {
+                size_t seg_start;
+                size_t seg_len;
+
+                while (i < len && path[i] == '/') {
+                        ++i;
+                }
+
+                seg_start = i;
+                while (i < len && path[i] != '/') {
+                        ++i;
+                }
+
+                seg_len = i - seg_start;
+                if (seg_len == 0 || (seg_len == 1 && path[seg_start] == '.')) {
+                        continue;
+                }
+
+                if (seg_len == 2 && path[seg_start] == '.' && path[seg_start + 1] == '.') {
+                        return 0;
+                }
+
+                if (seg_len > FS_NAME_MAX) {
+                        seg_len = FS_NAME_MAX;
+                }
+
+                if (out + seg_len + 1 > FS_DCACHE_PATH_MAX) {
+                        return 0;
+                }
+
+                if (out > 0) {
+                        key[out++] = '/';
+                }
+
+                for (size_t j = 0; j < seg_len; ++j) {
+                        key[out++] = path[seg_start + j];
+                }
+        }
+
+        *key_len = out;
+        return 1;
+}
+
+/*
+ * Walk path[0..len) from node one segment at a time. On failure *stop is the
+ * node whose lookup missed.
+ */
+static FSNode* walk_path(FSNode* node, const char* path, size_t len, FSNode** stop)
+{
+        size_t i = 0;
+
+        while (i < len) {
+                char segment[FS_NAME_MAX + 1];
+                size_t seg_len = 0;
+                FSNode* next;
+
+                while (i < len && path[i] == '/') {
+                        ++i;
+                }
+
+                if (i >= len) {
+                        break;
+                }
+
+                while (i < len && path[i] != '/') {
+                        if (seg_len + 1 < sizeof(segment)) {
+                                segment[seg_len++] = path[i];
+                        }
+                        ++i;
+                }
+
+                segment[seg_len] = '\0';
+
+                if (strcmp(segment, ".") == 0) {
+                        continue;
+                }
+
+                stats.segments_walked++;
+
+                if (strcmp(segment, "..") == 0) {
+                        if (node && node->parent) {
+                                node = node->parent;
+                        }
+                        continue;
+                }
+
+                next = fs_lookup(node, segment);
+                if (!next) {
+                        *stop = node;
+                        return NULL;
+                }
+
+                node = next;
+        }
+
+        return node;
+}
+
+static unsigned int count_segments(const char* path, size_t len)
+{
+        unsigned int segments = 0;
+
+        for (size_t i = 0; i < len; ++i) {
+                if (path[i] != '/' && (i == 0 || path[i - 1] == '/')) {
+                        ++segments;
+                }
+        }
+
+        return segments;
+}
+
+static FSNode* resolve_from(FSNode* start, const char* path, size_t len)
+{
+        char key[FS_DCACHE_PATH_MAX];
+        size_t key_len;
+        unsigned int hash;
+        DcacheEntry* entry;
+        FSNode* stop = NULL;
+        FSNode* node;
+
+        stats.resolves++;
+        stats.path_segments += count_segments(path, len);
+
+        if (!start || !normalize_path(path, len, key, &key_len)) {
+                return walk_path(start, path, len, &stop);
+        }
+
+        if (key_len == 0) {
+                return start;
+        }
+
+        hash = 2166136261u ^ (unsigned int)((size_t)start >> 4);
+        for (size_t i = 0; i < key_len; ++i) {
+                hash ^= (unsigned char)key[i];
+                hash *= 16777619u;
+        }
+
+        entry = &dcache[hash & (FS_DCACHE_SLOTS - 1)];
+
+        if (entry->start.node == start && fs_ref_get(entry->start) && entry->hash == hash
+                && entry->path_len == key_len) {
+                if (memcmp(entry->path, key, key_len) == 0) {
+                        if (entry->result.node && fs_ref_get(entry->result)) {
+                                stats.resolve_hits++;
+                                return entry->result.node;
+                        }
+
+                        if (!entry->result.node && fs_ref_get(entry->stop)) {
+                                stats.resolve_hits++;
+                                return NULL;
+                        }
+                }
+        }
+
+        node = walk_path(start, key, key_len, &stop);
+
+        entry->start = fs_ref(start);
+        entry->result = fs_ref(node);
+        entry->stop = fs_ref(stop);
+        entry->hash = hash;
+        entry->path_len = key_len;
+        memcpy(entry->path, key, key_len);
+
+        return node;
+}
+
+void fs_init()
+{
+	// Hand back heap storage still held by a previous tree.
+	for (size_t c = 0; c < node_chunk_count; ++c) {
+		for (size_t i = 0; i < chunk_carved(c); ++i) {
+			FSNode* node = &node_chunks[c]->nodes[i];
+
+			if (node_set_has(node_set(LIVE_SET), node_slot(node)) && node->type == NODE_DIR) {
+				kfree(node->dir);
+			}
+		}
+
+		kfree(node_chunks[c]);
+	}
+
+	kfree(node_chunks);
+	kfree(node_set_words);
+
+	while (long_names) {
+		LongName* next = long_names->next;
+
+		kfree(long_names);
+		long_names = next;
+	}
+
+	if (content_pool != content_pool_static) {
+		kfree(content_pool);
+		content_pool = content_pool_static;
+		content_pool_size = FS_CONTENT_POOL_SIZE;
+	}
+
+	node_chunks = NULL;
+	node_chunk_count = 0;
+	node_chunk_capacity = 0;
+	node_chunk_used = 0;
+	node_set_words = NULL;
+	node_set_width = 0;
+	node_free_list = NULL;
+	nodes_live = 0;
+	dirs_live = 0;
+	long_names_live = 0;
+	stats = (FSStats){ 0 };
+	content_pool_used = 0;
+	content_free_bytes = 0;
+
+	for (size_t i = 0; i < CONTENT_CLASSES; ++i) {
+		content_free_lists[i] = NULL;
+	}
+
+	for (size_t i = 0; i < FS_HASH_BUCKETS; ++i) {
+		dentry_buckets[i] = NULL;
+	}
+
+	dcache_clear();
+
+	for (size_t i = 0; i < FS_MAX_OPEN_FILES; ++i) {
+		open_files[i].file.node = NULL;
+	}
 
-static FSNode node_pool[FS_MAX_NODES];
-static size_t node_pool_used = 0;
-static FSNode root_node;
-static FSNode* current_working_directory = NULL;
+	root_dir.first_child = NULL;
+	root_dir.last_child = NULL;
+	root_dir.index_root = NULL;
+	root_dir.child_count = 0;
 
-static char content_pool[FS_CONTENT_POOL_SIZE];
-static size_t content_pool_used = 0;
+	root_node.name_len = 0;
+	set_node_name(&root_node, "/");
+	root_node.hash_next = NULL;
+	root_node.type = NODE_DIR;
+	root_node.parent = NULL;
+	root_node.prev_sibling = NULL;
+	root_node.next_sibling = NULL;
+	root_node.index_left = NULL;
+	root_node.index_right = NULL;
+	root_node.dir = &root_dir;
+	root_node.size = 0;
+	root_node.flags = 0;
+	root_node.ino = 0;
+	current_working_directory = fs_ref(&root_node);
+}
 
-static size_t kstrlen(const char* str)
+static int add_child(FSNode* parent, FSNode* child)
 {
-	size_t len = 0;
-	if (!str) {
-		return 0;
-	}
+        FSNode* successor;
+        FSDir* dir;
 
-	while (str[len] != '\0') {
-		++len;
-	}
+        if (!parent || parent->type != NODE_DIR) {
+                return -1;
+        }
+
+        dir = parent->dir;
+        child->parent = parent;
+        child->index_left = NULL;
+        child->index_right = NULL;
+        successor = index_successor(parent, child);
+        dir->index_root = index_insert(dir->index_root, child);
+
+        // Splice in front of the successor so the list stays in name order.
+        child->next_sibling = successor;
+        child->prev_sibling = successor ? successor->prev_sibling : dir->last_child;
+
+        if (child->prev_sibling) {
+                child->prev_sibling->next_sibling = child;
+        } else {
+                dir->first_child = child;
+        }
+
+        if (successor) {
+                successor->prev_sibling = child;
+        } else {
+                dir->last_child = child;
+        }
 
-	return len;
+        dir->child_count++;
+        dentry_insert(child);
+        dcache_note_create(parent);
+        return 0;
 }
 
-static int kstrcmp(const char* a, const char* b)
+static int detach_child(FSNode* node)
 {
-	size_t i = 0;
+        FSNode* parent;
+        FSDir* dir;
 
-	if (!a || !b) {
-		return a == b ? 0 : -1;
-	}
+        if (!node || !node->parent) {
+                return -1;
+        }
 
-	while (a[i] != '\0' && b[i] != '\0') {
-			if (a[i] != b[i]) {
-				return (int)((unsigned char)a[i] - (unsigned char)b[i]);
-			}
-			++i;
-	}
+        parent = node->parent;
+        dir = parent->dir;
+        dentry_remove(node);
+        dir->index_root = index_remove(dir->index_root, node);
+
+        if (node->prev_sibling) {
+                node->prev_sibling->next_sibling = node->next_sibling;
+        } else {
+                dir->first_child = node->next_sibling;
+        }
+
+        if (node->next_sibling) {
+                node->next_sibling->prev_sibling = node->prev_sibling;
+        } else {
+                dir->last_child = node->prev_sibling;
+        }
+
+        node->prev_sibling = NULL;
+        node->next_sibling = NULL;
+        dir->child_count--;
+        node->parent = NULL;
+
+        return 0;
+}
 
-	return (int)((unsigned char)a[i] - (unsigned char)b[i]);
+int fs_is_dir(FSNode* node)
+{
+        return node && node->type == NODE_DIR;
 }
 
-static void kstrncpy(char* dest, const char* src, size_t max_len)
+int fs_is_file(FSNode* node)
 {
-	size_t i;
+        return node && node->type == NODE_FILE;
+}
 
-	for (i = 0; i + 1 < max_len && src[i] != '\0'; ++i) {
-		dest[i] = src[i];
-	}
+int fs_is_empty_dir(FSNode* node)
+{
+        if (!fs_is_dir(node)) {
+                return 0;
+        }
 
-	dest[i] = '\0';
+        return node->dir->child_count == 0;
 }
 
-static FSNode* allocate_node(NodeType type, const char* name, FSNode* parent)
+FSNode* fs_create_file(FSNode* parent, const char* name)
 {
 	FSNode* node;
 
-	if (node_pool_used >= FS_MAX_NODES) {
+	if (!parent || parent->type != NODE_DIR) {
+		return NULL;
+	}
+
+	if (parent->flags & FS_NODE_READONLY) {
 		return NULL;
 	}
 
-	node = &node_pool[node_pool_used++];
-	kstrncpy(node->name, name, sizeof(node->name));
-	node->type = type;
-	node->parent = parent;
-	node->child_count = 0;
-	for (int i = 0; i < 32; ++i) {
-		node->children[i] = NULL;
+	node = allocate_node(NODE_FILE, name, parent);
+	if (!node) {
+		return NULL;
+	}
+
+	if (add_child(parent, node) != 0) {
+		return NULL;
 	}
-	node->content = NULL;
 
 	return node;
 }
 
-void fs_init()
+FSNode* fs_create_dir(FSNode* parent, const char* name)
 {
-	node_pool_used = 0;
-	content_pool_used = 0;
+        FSNode* node;
 
-	kstrncpy(root_node.name, "/", sizeof(root_node.name));
-	root_node.type = NODE_DIR;
-	root_node.parent = NULL;
-	root_node.child_count = 0;
-	for (int i = 0; i < 32; ++i) {
-		root_node.children[i] = NULL;
+	if (!parent || parent->type != NODE_DIR) {
+		return NULL;
+	}
+
+	if (parent->flags & FS_NODE_READONLY) {
+		return NULL;
+	}
+
+	node = allocate_node(NODE_DIR, name, parent);
+	if (!node) {
+		return NULL;
+	}
+
+	if (add_child(parent, node) != 0) {
+		return NULL;
 	}
-	root_node.content = NULL;
-	current_working_directory = &root_node;
+
+        return node;
 }
 
-static int add_child(FSNode* parent, FSNode* child)
+FSNode* fs_mkdir(FSNode* parent, const char* name)
 {
+        FSNode* existing;
+
         if (!parent || parent->type != NODE_DIR) {
-                return -1;
+                return NULL;
+        }
+
+        existing = fs_lookup(parent, name);
+        if (existing) {
+                if (existing->type == NODE_DIR) {
+                        return existing;
+                }
+
+                return NULL;
         }
 
-	if (parent->child_count >= 32) {
-		return -1;
+        return fs_create_dir(parent, name);
+}
+
+FSNode* fs_lookup(FSNode* parent, const char* name)
+{
+        unsigned int name_hash;
+        FSNode* node;
+
+	if (!parent || parent->type != NODE_DIR || !name) {
+		return NULL;
 	}
 
-        parent->children[parent->child_count++] = child;
-        return 0;
+        stats.lookups++;
+        name_hash = hash_bytes(name, strlen(name));
+
+        for (node = dentry_buckets[dentry_bucket(parent, name_hash)]; node; node = node->hash_next) {
+                if (node->parent == parent && node->name_hash == name_hash && strcmp(fs_name(node), name) == 0) {
+                        return node;
+                }
+        }
+
+	return NULL;
 }
 
-static int detach_child(FSNode* node)
+FSNode* fs_lookup_prefix(FSNode* parent, const char* prefix)
+{
+        FSNode* best = NULL;
+        size_t len;
+
+        if (!fs_is_dir(parent) || !prefix) {
+                return NULL;
+        }
+
+        // Lower bound: the leftmost child whose name is not below prefix.
+        for (FSNode* tree = parent->dir->index_root; tree;) {
+                if (strcmp(fs_name(tree), prefix) >= 0) {
+                        best = tree;
+                        tree = tree->index_left;
+                } else {
+                        tree = tree->index_right;
+                }
+        }
+
+        len = strlen(prefix);
+        for (size_t i = 0; best && i < len; ++i) {
+                if (fs_name(best)[i] != prefix[i]) {
+                        return NULL;
+                }
+        }
+
+        return best;
+}
+
+/* '*' matches any run of characters and '?' any single one. */
+static int glob_match(const char* pattern, const char* name)
+{
+        const char* star = NULL;
+        const char* resume = NULL;
+
+        while (*name) {
+                if (*pattern == '*') {
+                        star = pattern++;
+                        resume = name;
+                } else if (*pattern && (*pattern == '?' || *pattern == *name)) {
+                        ++pattern;
+                        ++name;
+                } else if (star) {
+                        pattern = star + 1;
+                        name = ++resume;
+                } else {
+                        return 0;
+                }
+        }
+
+        while (*pattern == '*') {
+                ++pattern;
+        }
+
+        return *pattern == '\0';
+}
+
+int fs_find(FSNode* start, const char* pattern, FSWalkFn fn, void* ctx)
+{
+        unsigned int* candidates;
+        size_t width = node_set_width;
+        size_t run = 0;
+        int wildcard = 0;
+        int result = 0;
+
+        if (!start || !pattern || !fn) {
+                return -1;
+        }
+
+        if (width == 0) {
+                return 0;
+        }
+
+        // A private copy of the live set for the index lookups below to narrow.
+        candidates = kmalloc(width * sizeof(*candidates));
+
+        if (!candidates) {
+                return -1;
+        }
+
+        memcpy(candidates, node_set(LIVE_SET), width * sizeof(*candidates));
+
+        // Every literal run of three or more characters must appear in a
+        // matching name, so each of its trigrams narrows the candidates.
+        for (size_t i = 0; pattern[i] != '\0'; ++i) {
+                if (pattern[i] == '*' || pattern[i] == '?') {
+                        wildcard = 1;
+                        run = 0;
+                } else if (++run >= 3) {
+                        node_set_intersect(candidates, node_set(TRIGRAM_SET(trigram_bucket(pattern + i - 2))));
+                }
+        }
+
+        if (!wildcard) {
+                unsigned int hash = hash_bytes(pattern, strlen(pattern));
+
+                node_set_intersect(candidates, node_set(NAME_SET(hash)));
+        }
+
+        for (size_t word = 0; word < width && result == 0; ++word) {
+                unsigned int bits = candidates[word];
+
+                while (bits) {
+                        size_t bit = (size_t)__builtin_ctz(bits);
+                        FSNode* node = node_at(word * 32 + bit);
+                        FSNode* ancestor = node;
+                        int depth = 0;
+
+                        bits &= bits - 1;
+
+                        if (!glob_match(pattern, fs_name(node))) {
+                                continue;
+                        }
+
+                        while (ancestor && ancestor != start) {
+                                ancestor = ancestor->parent;
+                                ++depth;
+                        }
+
+                        if (ancestor && fn(node, depth, ctx) == FS_WALK_STOP) {
+                                result = -1;
+                                break;
+                        }
+                }
+        }
+
+        kfree(candidates);
+        return result;
+}
+
+FSNode* fs_resolve_path(FSNode* cwd, const char* path)
+{
+        if (!path || path[0] == '\0') {
+                return cwd;
+        }
+
+        return resolve_from(path[0] == '/' ? &root_node : cwd, path, strlen(path));
+}
+
+FSNode* fs_resolve_parent(FSNode* cwd, const char* path, char* leaf, size_t leaf_size)
 {
         FSNode* parent;
-        int index = -1;
+        size_t len;
+        size_t leaf_len;
+        int last_sep = -1;
+
+        if (!path || !leaf || leaf_size == 0) {
+                return NULL;
+        }
+
+        len = strlen(path);
+
+        while (len > 1 && path[len - 1] == '/') {
+                --len;
+        }
+
+        for (size_t i = 0; i < len; ++i) {
+                if (path[i] == '/') {
+                        last_sep = (int)i;
+                }
+        }
+
+        if (last_sep != -1 && (size_t)last_sep >= len - 1) {
+                return NULL;
+        }
+
+        leaf_len = len - (size_t)(last_sep + 1);
+        if (leaf_len >= leaf_size) {
+                leaf_len = leaf_size - 1;
+        }
+
+        memcpy(leaf, path + last_sep + 1, leaf_len);
+        leaf[leaf_len] = '\0';
+
+        if (last_sep == -1) {
+                return cwd;
+        }
+
+        // The parent is the prefix before the last separator; resolve it in
+        // place rather than copying it out.
+        if (last_sep == 0) {
+                parent = &root_node;
+        } else {
+                parent = resolve_from(path[0] == '/' ? &root_node : cwd, path, (size_t)last_sep);
+        }
+
+        return fs_is_dir(parent) ? parent : NULL;
+}
+
+int fs_remove(FSNode* node)
+{
+        if (!node || node == &root_node || (node->flags & FS_NODE_READONLY)) {
+                return -1;
+        }
+
+        if (node->parent && (node->parent->flags & FS_NODE_READONLY)) {
+                return -1;
+        }
+
+        if (fs_is_dir(node) && !fs_is_empty_dir(node)) {
+                return -1;
+        }
+
+        if (detach_child(node) != 0) {
+                return -1;
+        }
+
+        release_node(node);
+        return 0;
+}
+
+int fs_walk(FSNode* node, FSWalkFn pre, FSWalkFn post, void* ctx)
+{
+        FSNode* current = node;
+        int depth = 0;
+
+        while (current) {
+                int action = pre ? pre(current, depth, ctx) : FS_WALK_CONTINUE;
+
+                if (action == FS_WALK_STOP) {
+                        return -1;
+                }
+
+                if (action != FS_WALK_SKIP && fs_first_child(current)) {
+                        current = fs_first_child(current);
+                        ++depth;
+                        continue;
+                }
+
+                // Climb until a node has a sibling left. Both links are read
+                // before post runs, since post may release the node.
+                for (;;) {
+                        FSNode* next = current == node ? NULL : current->next_sibling;
+                        FSNode* parent = current->parent;
+
+                        if (post && post(current, depth, ctx) == FS_WALK_STOP) {
+                                return -1;
+                        }
+
+                        if (current == node) {
+                                return 0;
+                        }
+
+                        if (next) {
+                                current = next;
+                                break;
+                        }
+
+                        current = parent;
+                        --depth;
+                }
+        }
+
+        return 0;
+}
+
+static int remove_walked(FSNode* node, int depth, void* ctx)
+{
+        (void)depth;
+        (void)ctx;
+
+        return fs_remove(node) == 0 ? FS_WALK_CONTINUE : FS_WALK_STOP;
+}
+
+int fs_remove_recursive(FSNode* node)
+{
+        if (!node || node == &root_node || (node->flags & FS_NODE_READONLY)) {
+                return -1;
+        }
+
+        return fs_walk(node, NULL, remove_walked, NULL);
+}
+
+int fs_move(FSNode* node, FSNode* target_parent, const char* new_name, int replace)
+{
+        FSNode* existing;
+
+        if (!node || !node->parent || !fs_is_dir(target_parent) || !new_name) {
+                return -1;
+        }
 
-        if (!node || !node->parent) {
+        if ((node->flags | node->parent->flags | target_parent->flags) & FS_NODE_READONLY) {
                 return -1;
         }
 
-        parent = node->parent;
+        // Moving a directory under itself would cut the subtree off from the
+        // root in a cycle that walks and parent chains never leave.
+        if (node_within(target_parent, node)) {
+                return -1;
+        }
 
-        for (int i = 0; i < parent->child_count; ++i) {
-                if (parent->children[i] == node) {
-                        index = i;
-                        break;
-                }
+        existing = fs_lookup(target_parent, new_name);
+        if (existing == node) {
+                existing = NULL;
         }
 
-        if (index == -1) {
+        // Only a file replaces a file. Everything that could fail is checked
+        // here, so the entry being replaced is never lost to a failed move.
+        if (existing && (!replace || !fs_is_file(existing) || !fs_is_file(node)
+                || (existing->flags & FS_NODE_READONLY))) {
                 return -1;
         }
 
-        for (int i = index; i < parent->child_count - 1; ++i) {
-                parent->children[i] = parent->children[i + 1];
+        if (!name_storable(new_name)) {
+                return -1;
         }
 
-        parent->children[parent->child_count - 1] = NULL;
-        parent->child_count--;
-        node->parent = NULL;
+        dcache_note_move(node);
 
-        return 0;
-}
+        if (detach_child(node) != 0) {
+                return -1;
+        }
 
-int fs_is_dir(FSNode* node)
-{
-        return node && node->type == NODE_DIR;
+        // Rename before removing the old entry: while it still holds the
+        // name, a long name is shared rather than allocated again.
+        name_index_update(node, 0);
+        set_node_name(node, new_name);
+        name_index_update(node, 1);
+        node->flags |= FS_NODE_DIRTY;
+
+        if (existing) {
+                fs_remove(existing);
+        }
+
+        return add_child(target_parent, node);
 }
 
-int fs_is_file(FSNode* node)
+static int file_writable(FSNode* file)
 {
-        return node && node->type == NODE_FILE;
+        return fs_is_file(file) && !(file->flags & FS_NODE_READONLY);
 }
 
-int fs_is_empty_dir(FSNode* node)
+FSNode* fs_clone_node(FSNode* node)
 {
-        if (!fs_is_dir(node)) {
-                return 0;
+        FSNode* clone;
+
+        if (!node) {
+                return NULL;
+        }
+
+        clone = allocate_node((NodeType)node->type, fs_name(node), NULL);
+        if (!clone) {
+                return NULL;
+        }
+
+        if (node->type == NODE_FILE) {
+                share_content(clone, node);
         }
 
-        return node->child_count == 0;
+        return clone;
 }
 
-FSNode* fs_create_file(FSNode* parent, const char* name)
+/*
+ * Copy walk state. dst is the copy of the directory being walked: it steps
+ * down in copy_entered and back up through its parent link in copy_left, so
+ * the walk needs no stack of destinations.
+ */
+typedef struct {
+        FSNode* dst_parent;
+        const char* new_name;
+        FSNode* dst;
+} CopyWalk;
+
+static int copy_entered(FSNode* src, int depth, void* ctx)
 {
-	FSNode* node;
+        CopyWalk* walk = ctx;
+        FSNode* parent = depth == 0 ? walk->dst_parent : walk->dst;
+        const char* name = depth == 0 ? walk->new_name : fs_name(src);
+        FSNode* copy = fs_lookup(parent, name);
 
-	if (!parent || parent->type != NODE_DIR) {
-		return NULL;
-	}
+        if (src->type == NODE_FILE) {
+                if (!copy) {
+                        copy = fs_create_file(parent, name);
+                        if (!copy) {
+                                return FS_WALK_STOP;
+                        }
+                } else if (!fs_is_file(copy)) {
+                        return FS_WALK_STOP;
+                }
 
-	node = allocate_node(NODE_FILE, name, parent);
-	if (!node) {
-		return NULL;
-	}
+                if (copy == src) {
+                        return FS_WALK_CONTINUE;
+                }
 
-	if (add_child(parent, node) != 0) {
-		return NULL;
-	}
+                if (!file_writable(copy)) {
+                        return FS_WALK_STOP;
+                }
 
-	return node;
+                share_content(copy, src);
+                return FS_WALK_CONTINUE;
+        }
+
+        if (copy) {
+                if (!fs_is_dir(copy)) {
+                        return FS_WALK_STOP;
+                }
+        } else {
+                copy = fs_create_dir(parent, name);
+                if (!copy) {
+                        return FS_WALK_STOP;
+                }
+        }
+
+        walk->dst = copy;
+        return FS_WALK_CONTINUE;
 }
 
-FSNode* fs_create_dir(FSNode* parent, const char* name)
+static int copy_left(FSNode* src, int depth, void* ctx)
 {
-        FSNode* node;
-
-	if (!parent || parent->type != NODE_DIR) {
-		return NULL;
-	}
+        CopyWalk* walk = ctx;
 
-	node = allocate_node(NODE_DIR, name, parent);
-	if (!node) {
-		return NULL;
-	}
+        (void)depth;
 
-	if (add_child(parent, node) != 0) {
-		return NULL;
-	}
+        if (src->type == NODE_DIR) {
+                walk->dst = walk->dst->parent;
+        }
 
-        return node;
+        return FS_WALK_CONTINUE;
 }
 
-FSNode* fs_mkdir(FSNode* parent, const char* name)
+int fs_copy_recursive(FSNode* src, FSNode* dst_parent, const char* new_name)
 {
-        FSNode* existing;
+        CopyWalk walk;
 
-        if (!parent || parent->type != NODE_DIR) {
-                return NULL;
+        if (!src || !dst_parent || dst_parent->type != NODE_DIR || !new_name) {
+                return -1;
         }
 
-        existing = fs_lookup(parent, name);
-        if (existing) {
-                if (existing->type == NODE_DIR) {
-                        return existing;
-                }
+        walk.dst_parent = dst_parent;
+        walk.new_name = new_name;
+        walk.dst = NULL;
 
-                return NULL;
+        return fs_walk(src, copy_entered, copy_left, &walk);
+}
+
+void fs_get_stats(FSStats* out)
+{
+        if (!out) {
+                return;
         }
 
-        return fs_create_dir(parent, name);
+        *out = stats;
+        out->nodes_used = nodes_live;
+        out->nodes_capacity = node_chunk_count * NODES_PER_CHUNK;
+        out->dirs_used = dirs_live;
+        out->long_names_used = long_names_live;
+        out->content_live = content_pool_used - content_free_bytes;
+        out->content_dead = content_free_bytes;
+        out->content_carved = content_pool_used;
+        out->content_max = content_pool_size;
 }
 
-FSNode* fs_lookup(FSNode* parent, const char* name)
+FSNode* fs_get_cwd()
 {
-	if (!parent || parent->type != NODE_DIR) {
-		return NULL;
-	}
-
-	for (int i = 0; i < parent->child_count; ++i) {
-		FSNode* child = parent->children[i];
+	FSNode* cwd = fs_ref_get(current_working_directory);
 
-		if (kstrcmp(child->name, name) == 0) {
-			return child;
-		}
+	/* The directory we were in has been removed; fall back to the root. */
+	if (!cwd) {
+		current_working_directory = fs_ref(&root_node);
+		return &root_node;
 	}
 
-	return NULL;
+	return cwd;
 }
 
-FSNode* fs_resolve_path(FSNode* cwd, const char* path)
+void fs_set_cwd(FSNode* node)
 {
-        FSNode* node;
-        size_t i = 0;
+	if (node && node->type == NODE_DIR) {
+		current_working_directory = fs_ref(node);
+	}
+}
 
-        if (!path || path[0] == '\0') {
-                return cwd;
+int fs_map_content(FSNode* file, const char* data, size_t size)
+{
+        if (!file_writable(file) || (!data && size > 0)) {
+                return -1;
         }
 
-        node = (path[0] == '/') ? &root_node : cwd;
+        content_release(file->content);
+        file->content = (char*)data;
+        file->size = size;
+        file->flags |= FS_NODE_DIRTY_DATA;
 
-        if (path[0] == '/') {
-                i = 1;
-        }
+        return 0;
+}
 
-        while (path[i] != '\0') {
-                char segment[32];
-                size_t seg_len = 0;
+static int freeze_walked(FSNode* node, int depth, void* ctx)
+{
+        (void)depth;
+        (void)ctx;
 
-                while (path[i] == '/') {
-                        ++i;
-                }
+        node->flags |= FS_NODE_READONLY;
+        return FS_WALK_CONTINUE;
+}
 
-                if (path[i] == '\0') {
-                        break;
-                }
+void fs_mark_readonly(FSNode* node)
+{
+        fs_walk(node, freeze_walked, NULL, NULL);
+}
 
-                while (path[i] != '\0' && path[i] != '/' && seg_len + 1 < sizeof(segment)) {
-                        segment[seg_len++] = path[i++];
-                }
+static int write_range(FSNode* file, size_t offset, const char* data, size_t len)
+{
+        size_t end;
 
-                segment[seg_len] = '\0';
+        if (!file_writable(file) || (!data && len > 0)) {
+                return -1;
+        }
 
-                if (seg_len == 0 || kstrcmp(segment, ".") == 0) {
-                        continue;
-                }
+        end = offset + len;
+        if (end < offset || reserve_content(file, end + 1, &data) != 0) {
+                return -1;
+        }
 
-                if (kstrcmp(segment, "..") == 0) {
-                        if (node && node->parent) {
-                                node = node->parent;
-                        }
-                        continue;
-                }
+        // Writing past the end leaves a hole that reads back as zero bytes.
+        for (size_t i = file->size; i < offset; ++i) {
+                file->content[i] = '\0';
+        }
 
-                node = fs_lookup(node, segment);
-                if (!node) {
-                        return NULL;
-                }
+        memmove(file->content + offset, data, len);
+        file->flags |= FS_NODE_DIRTY_DATA;
+
+        if (end > file->size) {
+                file->size = end;
+                file->content[end] = '\0';
         }
 
-        return node;
+        return (int)len;
 }
 
-int fs_remove(FSNode* node)
+int fs_write(FSNode* file, const char* data)
 {
-        if (!node || node == &root_node) {
-                return -1;
-        }
-
-        if (fs_is_dir(node) && !fs_is_empty_dir(node)) {
+        if (!file_writable(file) || !data) {
                 return -1;
         }
 
-        return detach_child(node);
+        stats.writes++;
+        return replace_content(file, data, strlen(data));
 }
 
-int fs_remove_recursive(FSNode* node)
+int fs_append(FSNode* file, const char* data)
 {
-        if (!node || node == &root_node) {
+        if (!file_writable(file) || !data) {
                 return -1;
         }
 
-        if (fs_is_dir(node)) {
-                while (node->child_count > 0) {
-                        FSNode* child = node->children[node->child_count - 1];
-
-                        if (fs_remove_recursive(child) != 0) {
-                                return -1;
-                        }
-                }
-        }
-
-        return fs_remove(node);
+        stats.appends++;
+        return write_range(file, file->size, data, strlen(data)) < 0 ? -1 : 0;
 }
 
-FSNode* fs_clone_node(FSNode* node)
+int fs_write_range(FSNode* file, size_t offset, const char* data, size_t len)
 {
-        FSNode* clone;
+        stats.writes++;
+        return write_range(file, offset, data, len);
+}
 
-        if (!node) {
-                return NULL;
+int fs_read_range(FSNode* file, size_t offset, char* buf, size_t len)
+{
+        if (!file || file->type != NODE_FILE || (!buf && len > 0)) {
+                return -1;
         }
 
-        clone = allocate_node(node->type, node->name, NULL);
-        if (!clone) {
-                return NULL;
+        if (offset >= file->size) {
+                return 0;
         }
 
-        if (node->type == NODE_FILE && node->content) {
-                if (fs_write(clone, node->content) != 0) {
-                        return NULL;
-                }
+        if (len > file->size - offset) {
+                len = file->size - offset;
         }
 
-        return clone;
+        memmove(buf, file->content + offset, len);
+        return (int)len;
 }
 
-int fs_copy_recursive(FSNode* src, FSNode* dst_parent, const char* new_name)
+int fs_truncate(FSNode* file, size_t size)
 {
-        if (!src || !dst_parent || dst_parent->type != NODE_DIR || !new_name) {
+        if (!file_writable(file)) {
                 return -1;
         }
 
-        if (src->type == NODE_FILE) {
-                FSNode* file = fs_lookup(dst_parent, new_name);
-                const char* data = fs_read(src);
-
-                if (!file) {
-                        file = fs_create_file(dst_parent, new_name);
-                        if (!file) {
-                                return -1;
-                        }
-                } else if (!fs_is_file(file)) {
-                        return -1;
-                }
-
-                if (data) {
-                        return fs_write(file, data);
-                }
+        if (size > file->size) {
+                return write_range(file, size, NULL, 0) < 0 ? -1 : 0;
+        }
 
+        if (size == 0) {
+                content_release(file->content);
+                file->content = NULL;
+                file->size = 0;
+                file->flags |= FS_NODE_DIRTY_DATA;
                 return 0;
         }
 
-        if (src->type == NODE_DIR) {
-                FSNode* dir = fs_lookup(dst_parent, new_name);
-
-                if (dir) {
-                        if (!fs_is_dir(dir)) {
-                                return -1;
-                        }
-                } else {
-                        dir = fs_create_dir(dst_parent, new_name);
-                        if (!dir) {
-                                return -1;
-                        }
-                }
-
-                for (int i = 0; i < src->child_count; ++i) {
-                        FSNode* child = src->children[i];
-
-                        if (fs_copy_recursive(child, dir, child->name) != 0) {
-                                return -1;
-                        }
-                }
+        return replace_content(file, file->content, size);
+}
 
+size_t fs_size(FSNode* file)
+{
+        if (!file || file->type != NODE_FILE) {
                 return 0;
         }
 
-        return -1;
+        return file->size;
 }
 
-FSNode* fs_get_cwd()
+const char* fs_read(FSNode* file)
 {
-	return current_working_directory;
+	if (!file || file->type != NODE_FILE) {
+		return NULL;
+	}
+
+	return file->content;
 }
 
-void fs_set_cwd(FSNode* node)
+static FSHandle* handle_get(int fd, FSNode** file)
 {
-	if (node && node->type == NODE_DIR) {
-		current_working_directory = node;
-	}
+        FSHandle* handle;
+
+        if (fd < 0 || fd >= FS_MAX_OPEN_FILES) {
+                return NULL;
+        }
+
+        handle = &open_files[fd];
+        *file = fs_ref_get(handle->file);
+
+        return *file ? handle : NULL;
 }
 
-int fs_write(FSNode* file, const char* data)
+int fs_open(FSNode* file, int flags)
 {
-        size_t len;
-        size_t remaining;
+        if (!fs_is_file(file) || !(flags & (FS_OPEN_READ | FS_OPEN_WRITE))) {
+                return -1;
+        }
+
+        if ((flags & (FS_OPEN_APPEND | FS_OPEN_TRUNC)) && !(flags & FS_OPEN_WRITE)) {
+                return -1;
+        }
 
-        if (!file || file->type != NODE_FILE || !data) {
+        if ((flags & FS_OPEN_WRITE) && !file_writable(file)) {
                 return -1;
         }
 
-	len = kstrlen(data);
-	remaining = FS_CONTENT_POOL_SIZE - content_pool_used;
+        for (int fd = 0; fd < FS_MAX_OPEN_FILES; ++fd) {
+                FSHandle* handle = &open_files[fd];
 
-	if (len + 1 > remaining) {
-		return -1;
-	}
+                // Slots whose file was removed are reclaimed here as well.
+                if (handle->file.node && fs_ref_get(handle->file)) {
+                        continue;
+                }
 
-	file->content = &content_pool[content_pool_used];
+                if ((flags & FS_OPEN_TRUNC) && fs_truncate(file, 0) != 0) {
+                        return -1;
+                }
 
-	for (size_t i = 0; i < len; ++i) {
-		content_pool[content_pool_used++] = data[i];
-	}
+                handle->file = fs_ref(file);
+                handle->offset = 0;
+                handle->flags = flags;
 
-	content_pool[content_pool_used++] = '\0';
+                return fd;
+        }
 
-        return 0;
+        return -1;
 }
 
-int fs_append(FSNode* file, const char* data)
+int fs_read_fd(int fd, char* buf, size_t len)
 {
-        size_t existing_len = 0;
-        size_t new_len;
-        size_t remaining;
-        const char* existing;
+        FSNode* file;
+        FSHandle* handle = handle_get(fd, &file);
+        int read;
 
-        if (!file || file->type != NODE_FILE || !data) {
+        if (!handle || !(handle->flags & FS_OPEN_READ)) {
                 return -1;
         }
 
-        existing = file->content;
-        if (existing) {
-                existing_len = kstrlen(existing);
+        read = fs_read_range(file, handle->offset, buf, len);
+        if (read > 0) {
+                handle->offset += (size_t)read;
         }
 
-        new_len = kstrlen(data);
-        remaining = FS_CONTENT_POOL_SIZE - content_pool_used;
+        return read;
+}
+
+int fs_write_fd(int fd, const char* data, size_t len)
+{
+        FSNode* file;
+        FSHandle* handle = handle_get(fd, &file);
+        int written;
 
-        if (existing_len + new_len + 1 > remaining) {
+        if (!handle || !(handle->flags & FS_OPEN_WRITE)) {
                 return -1;
         }
 
-        file->content = &content_pool[content_pool_used];
+        if (handle->flags & FS_OPEN_APPEND) {
+                handle->offset = file->size;
+                stats.appends++;
+        } else {
+                stats.writes++;
+        }
+
+        written = write_range(file, handle->offset, data, len);
+        if (written > 0) {
+                handle->offset += (size_t)written;
+        }
+
+        return written;
+}
+
+int fs_seek(int fd, long offset, int whence)
+{
+        FSNode* file;
+        FSHandle* handle = handle_get(fd, &file);
+        long base;
 
-        for (size_t i = 0; i < existing_len; ++i) {
-                content_pool[content_pool_used++] = existing ? existing[i] : '\0';
+        if (!handle) {
+                return -1;
         }
 
-        for (size_t i = 0; i < new_len; ++i) {
-                content_pool[content_pool_used++] = data[i];
+        if (whence == FS_SEEK_SET) {
+                base = 0;
+        } else if (whence == FS_SEEK_CUR) {
+                base = (long)handle->offset;
+        } else if (whence == FS_SEEK_END) {
+                base = (long)file->size;
+        } else {
+                return -1;
         }
 
-        content_pool[content_pool_used++] = '\0';
+        // base is never negative, so only a positive offset can overflow and
+        // only a negative one can land before the start of the file.
+        if (offset > 0 ? offset > __LONG_MAX__ - base : offset < -base) {
+                return -1;
+        }
 
-        return 0;
+        handle->offset = (size_t)(base + offset);
+        return (int)handle->offset;
 }
 
-const char* fs_read(FSNode* file)
+int fs_close(int fd)
 {
-	if (!file || file->type != NODE_FILE) {
-		return NULL;
-	}
+        if (fd < 0 || fd >= FS_MAX_OPEN_FILES || !open_files[fd].file.node) {
+                return -1;
+        }
 
-	return file->content;
+        open_files[fd].file.node = NULL;
+        return 0;
 }
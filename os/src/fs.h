@@ -1,23 +1,97 @@
 #ifndef FS_H
 #define FS_H
 
+#include <stddef.h>
+
 typedef enum {
 	NODE_FILE,
 	NODE_DIR
 } NodeType;
 
+#define FS_NODE_READONLY 1   // node cannot be written, renamed or removed
+#define FS_NODE_DIRTY 2      // created, renamed or moved since the last disk sync
+#define FS_NODE_DIRTY_DATA 4 // contents changed since the last disk sync
+
+#define FS_NAME_MAX 31    // longest name a node can carry
+#define FS_INLINE_NAME 16 // names shorter than this are stored in the node
+
+struct FSNode;
+
+// Child storage, only allocated for directories. Children form a doubly
+// linked list kept in name order, so directories have no fixed cap,
+// unlinking never shifts siblings, and walking first_child..next_sibling
+// lists entries sorted. index_root is an ordered index over the children (a
+// treap keyed by name) that finds where a new entry belongs in the sibling
+// list without a linear scan.
+typedef struct FSDir {
+	struct FSNode* first_child;
+	struct FSNode* last_child;
+	struct FSNode* index_root;
+	int child_count;
+} FSDir;
+
+// Nodes are laid out so lookups, parent walks and sibling iteration only
+// touch the leading fields; on i386 the whole node is one 64-byte line.
+// Read the name through fs_name and children through fs_first_child.
 typedef struct FSNode {
-	char name[32];
-	NodeType type;
+	unsigned int name_hash;
+	unsigned char type;     // NodeType
+	unsigned char flags;    // FS_NODE_* bits
+	unsigned char name_len;
 	struct FSNode* parent;
+	struct FSNode* hash_next; // next entry in the same directory index bucket
+	struct FSNode* prev_sibling;
+	struct FSNode* next_sibling;
+	struct FSNode* index_left;  // links within the parent's index
+	struct FSNode* index_right;
 
-	struct FSNode* children[32];
-	int child_count;
+	union {
+		FSDir* dir;    // NODE_DIR
+		char* content; // NODE_FILE
+	};
+	size_t size;             // bytes in content, excluding the trailing NUL
+	unsigned int generation; // bumped every time the slot is recycled
+	unsigned int ino;        // on-disk inode number, 0 while only in memory
 
-	char* content; // only for NODE_FILE
+	union {
+		char inline_name[FS_INLINE_NAME]; // name_len < FS_INLINE_NAME
+		const char* long_name;            // interned, shared by equal names
+	};
 } FSNode;
 
+// Handle that can be held across removals: fs_ref_get returns NULL once the
+// node has been removed, even if its slot was reused for a new node.
+typedef struct {
+	FSNode* node;
+	unsigned int generation;
+} FSNodeRef;
+
+// usage counters since fs_init, plus a snapshot of pool occupancy
+typedef struct {
+	unsigned int lookups;       // single-name lookups, including path walks
+	unsigned int resolves;      // path resolutions
+	unsigned int resolve_hits;  // resolutions answered by the path cache
+	unsigned int path_segments; // segments named by resolved paths
+	unsigned int segments_walked; // segments actually looked up while resolving
+	unsigned int writes;
+	unsigned int appends;
+	unsigned int creates;
+	unsigned int removes;
+	unsigned int compactions;   // content pool compactions
+
+	size_t nodes_used, nodes_peak;
+	size_t nodes_capacity; // slots in the node chunks allocated so far
+	size_t dirs_used, dirs_peak;
+	size_t long_names_used;
+	size_t content_live;   // bytes in referenced blocks, headers included
+	size_t content_dead;   // freed blocks waiting for reuse or compaction
+	size_t content_carved; // high end of the carved region
+	size_t content_peak;   // highest content_carved seen
+	size_t content_max;    // current pool size; it grows on the heap
+} FSStats;
+
 void fs_init();
+void fs_get_stats(FSStats* out);
 
 // node creation
 FSNode* fs_create_file(FSNode* parent, const char* name);
@@ -25,8 +99,14 @@ FSNode* fs_create_dir(FSNode* parent, const char* name);
 FSNode* fs_mkdir(FSNode* parent, const char* name);
 
 // lookup + navigation
+const char* fs_name(const FSNode* node);
+FSNode* fs_first_child(const FSNode* dir);
 FSNode* fs_lookup(FSNode* parent, const char* name);
+// first child (in name order) whose name starts with prefix; continue with
+// next_sibling while the prefix still matches
+FSNode* fs_lookup_prefix(FSNode* parent, const char* prefix);
 FSNode* fs_resolve_path(FSNode* cwd, const char* path);
+FSNode* fs_resolve_parent(FSNode* cwd, const char* path, char* leaf, size_t leaf_size);
 FSNode* fs_clone_node(FSNode* node);
 int fs_copy_recursive(FSNode* src, FSNode* dst_parent, const char* new_name);
 int fs_is_dir(FSNode* node);
@@ -34,6 +114,32 @@ int fs_is_file(FSNode* node);
 int fs_is_empty_dir(FSNode* node);
 int fs_remove(FSNode* node);
 int fs_remove_recursive(FSNode* node);
+// move node under target_parent as new_name; fails if that would put a
+// directory inside itself. With replace set, a file may take the place of an
+// existing file of that name, which is only removed once the move can no
+// longer fail.
+int fs_move(FSNode* node, FSNode* target_parent, const char* new_name, int replace);
+
+// tree walks: visit node and everything below it in name order without
+// recursion, following the parent and sibling links. pre runs before a
+// node's children and post after them; either may be NULL, and post may
+// remove the node it is given. Returns 0, or -1 if a callback stopped it.
+#define FS_WALK_CONTINUE 0
+#define FS_WALK_SKIP 1 // from pre: do not descend into this node
+#define FS_WALK_STOP 2 // end the walk right away
+
+typedef int (*FSWalkFn)(FSNode* node, int depth, void* ctx);
+int fs_walk(FSNode* node, FSWalkFn pre, FSWalkFn post, void* ctx);
+
+// name search: call fn for every node at or below start whose name matches
+// the glob pattern ('*' matches any run, '?' any one character). Candidates
+// come from a global index of names and name trigrams, not a tree walk, so
+// they arrive in no particular order; fn must not change the tree.
+int fs_find(FSNode* start, const char* pattern, FSWalkFn fn, void* ctx);
+
+// stale pointer detection
+FSNodeRef fs_ref(FSNode* node);
+FSNode* fs_ref_get(FSNodeRef ref);
 
 // working directory
 FSNode* fs_get_cwd();
@@ -44,4 +150,33 @@ int fs_write(FSNode* file, const char* data);
 int fs_append(FSNode* file, const char* data);
 const char* fs_read(FSNode* file);
 
+// read-only mounts: map a file onto bytes that live outside the content pool
+// (they are not NUL-terminated, use fs_size), then freeze the whole subtree
+int fs_map_content(FSNode* file, const char* data, size_t size);
+void fs_mark_readonly(FSNode* node);
+
+// binary-safe I/O: contents may hold zero bytes, so use fs_size rather than
+// scanning for a terminator. Range calls return the byte count or -1.
+size_t fs_size(FSNode* file);
+int fs_read_range(FSNode* file, size_t offset, char* buf, size_t len);
+int fs_write_range(FSNode* file, size_t offset, const char* data, size_t len);
+int fs_truncate(FSNode* file, size_t size);
+
+// open file handles: a bounded table of per-handle offsets so callers can
+// stream a file in fixed-size chunks. Handles go stale if the file is removed.
+#define FS_OPEN_READ   1
+#define FS_OPEN_WRITE  2
+#define FS_OPEN_APPEND 4 // every write lands at the current end of file
+#define FS_OPEN_TRUNC  8 // empty the file when it is opened
+
+#define FS_SEEK_SET 0
+#define FS_SEEK_CUR 1
+#define FS_SEEK_END 2
+
+int fs_open(FSNode* file, int flags);
+int fs_read_fd(int fd, char* buf, size_t len);
+int fs_write_fd(int fd, const char* data, size_t len);
+int fs_seek(int fd, long offset, int whence);
+int fs_close(int fd);
+
 #endif
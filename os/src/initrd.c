@@ -0,0 +1,208 @@
+#include <stddef.h>
+#include "fs.h"
+#include "initrd.h"
+
+/* Check if the compiler thinks you are targeting the wrong operating system. */
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+/* This tutorial will only work for the 32-bit ix86 targets. */
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+#define TAR_BLOCK_SIZE 512
+
+/* POSIX ustar header; every field is ASCII, numbers are octal. */
+typedef struct {
+        char name[100];
+        char mode[8];
+        char uid[8];
+        char gid[8];
+        char size[12];
+        char mtime[12];
+        char checksum[8];
+        char typeflag;
+        char linkname[100];
+        char magic[6];
+        char version[2];
+        char uname[32];
+        char gname[32];
+        char devmajor[8];
+        char devminor[8];
+        char prefix[155];
+} TarHeader;
+
+static size_t parse_octal(const char* field, size_t len)
+{
+        size_t value = 0;
+
+        for (size_t i = 0; i < len && field[i] >= '0' && field[i] <= '7'; ++i) {
+                value = (value << 3) | (size_t)(field[i] - '0');
+        }
+
+        return value;
+}
+
+static int is_zero_block(const char* block)
+{
+        for (size_t i = 0; i < TAR_BLOCK_SIZE; ++i) {
+                if (block[i] != '\0') {
+                        return 0;
+                }
+        }
+
+        return 1;
+}
+
+static int is_ustar(const TarHeader* header)
+{
+        const char* magic = "ustar";
+
+        for (size_t i = 0; i < 5; ++i) {
+                if (header->magic[i] != magic[i]) {
+                        return 0;
+                }
+        }
+
+        return 1;
+}
+
+/*
+ * Walk the `len` bytes of path below dir, creating missing directories. When
+ * want_file is set the last segment becomes a file instead. Segments "." and
+ * empty ones are skipped so "./docs/a.txt" and "docs//a.txt" both work.
+ */
+static FSNode* create_path(FSNode* dir, const char* path, size_t len, int want_file)
+{
+        size_t i = 0;
+
+        while (i < len && dir) {
+                char segment[32];
+                size_t seg_len = 0;
+                FSNode* child;
+                int last;
+
+                while (i < len && path[i] == '/') {
+                        ++i;
+                }
+
+                if (i >= len) {
+                        break;
+                }
+
+                while (i < len && path[i] != '/') {
+                        if (seg_len + 1 < sizeof(segment)) {
+                                segment[seg_len++] = path[i];
+                        }
+                        ++i;
+                }
+
+                segment[seg_len] = '\0';
+
+                if (seg_len == 1 && segment[0] == '.') {
+                        continue;
+                }
+
+                while (i < len && path[i] == '/') {
+                        ++i;
+                }
+
+                last = i >= len;
+                child = fs_lookup(dir, segment);
+
+                if (!child) {
+                        child = (last && want_file) ? fs_create_file(dir, segment) : fs_create_dir(dir, segment);
+                }
+
+                if (!child || ((!last || !want_file) && !fs_is_dir(child)) || (last && want_file && !fs_is_file(child))) {
+                        return NULL;
+                }
+
+                dir = child;
+        }
+
+        return dir;
+}
+
+static int load_archive(const char* archive, size_t size, FSNode* mount_point)
+{
+        size_t offset = 0;
+        int entries = 0;
+
+        if (!archive || size < TAR_BLOCK_SIZE) {
+                return -1;
+        }
+
+        while (offset + TAR_BLOCK_SIZE <= size) {
+                const TarHeader* header = (const TarHeader*)(archive + offset);
+                char path[256];
+                size_t path_len = 0;
+                size_t file_size;
+
+                if (is_zero_block(archive + offset)) {
+                        break;
+                }
+
+                if (!is_ustar(header)) {
+                        return -1;
+                }
+
+                file_size = parse_octal(header->size, sizeof(header->size));
+                offset += TAR_BLOCK_SIZE;
+
+                if (file_size > size - offset) {
+                        return -1;
+                }
+
+                // Long names are split into prefix "/" name.
+                for (size_t i = 0; i < sizeof(header->prefix) && header->prefix[i] != '\0'; ++i) {
+                        path[path_len++] = header->prefix[i];
+                }
+
+                if (path_len > 0) {
+                        path[path_len++] = '/';
+                }
+
+                for (size_t i = 0; i < sizeof(header->name) && header->name[i] != '\0'; ++i) {
+                        path[path_len++] = header->name[i];
+                }
+
+                if (header->typeflag == '5') {
+                        FSNode* dir = create_path(mount_point, path, path_len, 0);
+
+                        if (dir && dir != mount_point) {
+                                ++entries;
+                        }
+                } else if (header->typeflag == '0' || header->typeflag == '\0') {
+                        FSNode* file = create_path(mount_point, path, path_len, 1);
+
+                        if (file && fs_map_content(file, archive + offset, file_size) == 0) {
+                                ++entries;
+                        }
+                }
+
+                // Links and special files are skipped; their data (if any) is padded
+                // to whole blocks like everything else.
+                offset += (file_size + TAR_BLOCK_SIZE - 1) / TAR_BLOCK_SIZE * TAR_BLOCK_SIZE;
+        }
+
+        return entries;
+}
+
+int initrd_mount(const char* archive, size_t size, FSNode* mount_point)
+{
+        int entries;
+
+        if (!fs_is_dir(mount_point)) {
+                return -1;
+        }
+
+        entries = load_archive(archive, size, mount_point);
+
+        // A damaged archive can fail after some entries were created; they
+        // are frozen like the rest so the mount is never writable.
+        fs_mark_readonly(mount_point);
+        return entries;
+}
@@ -0,0 +1,18 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_INITRD_H
+#define ENZOS_INITRD_H
+
+#include <stddef.h>
+#include "fs.h"
+
+/*
+ * Mount a ustar archive that already sits in memory (for example a GRUB
+ * module) under mount_point. File nodes point straight into the archive, so
+ * nothing is copied, and the whole subtree is left read-only, even when the
+ * archive turns out to be malformed part-way through. Returns the number of
+ * entries created or -1 if the archive is malformed.
+ */
+int initrd_mount(const char* archive, size_t size, FSNode* mount_point);
+
+#endif /* ENZOS_INITRD_H */
@@ -1,8 +1,17 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
+#include "bcache.h"
+#include "cpu.h"
+#include "diskfs.h"
+#include "drivers/ata.h"
+#include "drivers/block.h"
 #include "drivers/terminal.h"
 #include "fs.h"
+#include "initrd.h"
+#include "mm/paging.h"
+#include "mm/pmm.h"
+#include "multiboot.h"
 #include "shell/shell.h"
 
 /* Check if the compiler thinks you are targeting the wrong operating system. */
@@ -41,17 +50,110 @@ terminal_writestring(
 );
 }
 
-void kernel_main(void)
+/*
+ * Mount the first GRUB module as a read-only tree at /initrd. The archive is
+ * used in place, so it must stay where GRUB loaded it.
+ */
+static void mount_initrd(uint32_t magic, const multiboot_info_t* info)
+{
+	const multiboot_module_t* module;
+	FSNode* mount_point;
+
+	if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !info || !(info->flags & MULTIBOOT_INFO_MODS)
+		|| info->mods_count == 0) {
+		return;
+	}
+
+	module = (const multiboot_module_t*)(uintptr_t)info->mods_addr;
+	mount_point = fs_mkdir(fs_resolve_path(fs_get_cwd(), "/"), "initrd");
+
+	if (initrd_mount((const char*)(uintptr_t)module->mod_start, module->mod_end - module->mod_start,
+		mount_point) < 0) {
+		terminal_writestring("Initrd module is not a ustar archive.\n");
+		return;
+	}
+
+	terminal_writestring("Initrd mounted at /initrd.\n");
+}
+
+/*
+ * Load the tree saved on the first disk. A blank or foreign disk is left
+ * alone until the user formats it with mkfs.
+ */
+static void mount_disk(BlockDevice* device)
+{
+	if (diskfs_mount(device) == 0) {
+		terminal_writestring("Filesystem loaded from ");
+	} else if (diskfs_device() == device) {
+		terminal_writestring("Filesystem partially loaded from ");
+	} else {
+		terminal_writestring("No EnzOS filesystem on ");
+		terminal_writestring(device->name);
+		terminal_writestring("; run mkfs to format it.\n");
+		return;
+	}
+
+	terminal_writestring(device->name);
+	terminal_writestring(".\n");
+}
+
+static void write_number(size_t value)
+{
+	char digits[12];
+	size_t count = 0;
+
+	do {
+		digits[count++] = (char)('0' + value % 10);
+		value /= 10;
+	} while (value > 0);
+
+	while (count > 0) {
+		terminal_putchar(digits[--count]);
+	}
+}
+
+void kernel_main(uint32_t magic, const multiboot_info_t* info)
 {
 	/* Initialize terminal interface */
 	terminal_initialize();
 	enzos_splash();
 
+	pmm_init(magic, info);
+	paging_init();
 	fs_init();
 
 	terminal_setcolor(vga_entry_color(VGA_COLOR_LIGHT_GREY, VGA_COLOR_BLACK));
 	terminal_writestring("EnzOS booted successfully.\n");
+	if (pmm_total_frames() == 0) {
+		terminal_writestring("Memory: no usable RAM in the boot information (or more than ");
+		write_number(PMM_MAX_MODULES);
+		terminal_writestring(" modules); the kernel heap is disabled.\n");
+	} else {
+		terminal_writestring("Memory: ");
+		write_number(pmm_free_frames() * (PMM_FRAME_SIZE / 1024) / 1024);
+		terminal_writestring(" MiB free.\n");
+	}
+
+	if (paging_enabled()) {
+		terminal_writestring("Paging enabled, ");
+		write_number(paging_mapped_mib());
+		terminal_writestring(" MiB identity-mapped.\n");
+	}
+
+	if (cpu_sse_enabled()) {
+		terminal_writestring("FPU and SSE2 enabled.\n");
+	} else if (cpu_fpu_enabled()) {
+		terminal_writestring("FPU enabled.\n");
+	}
 	terminal_writestring("Filesystem initialized.\n");
+	mount_initrd(magic, info);
+
+	bcache_init();
+
+	if (ata_initialize() > 0) {
+		mount_disk(block_device_at(0));
+	}
+
 	terminal_writestring("\n");
 
 	enzos_shell();
@@ -30,8 +30,12 @@ uninitialized stack. The stack on x86 must be 16-byte aligned according to the
 System V ABI standard and de-facto extensions. The compiler will assume the
 stack is properly aligned and failure to align the stack will result in
 undefined behavior.
+
+The stack has a section of its own so linker.ld can put it on a page boundary
+right above an unmapped guard page. Overflowing it then faults instead of
+silently overwriting whatever .bss data happened to be below.
 */
-.section .bss
+.section .stack, "aw", @nobits
 .align 16
 stack_bottom:
 .skip 16384 # 16 KiB
@@ -69,22 +73,39 @@ _start:
 	/*
 	This is a good place to initialize crucial processor state before the
 	high-level kernel is entered. It's best to minimize the early
-	environment where crucial features are offline. Note that the
-	processor is not fully initialized yet: Features such as floating
-	point instructions and instruction set extensions are not initialized
-	yet. The GDT should be loaded here. Paging should be enabled here.
-	C++ features such as global constructors and exceptions will require
-	runtime support to work as well.
+	environment where crucial features are offline. The x87 FPU, and SSE
+	with FXSAVE when the CPU has them, are switched on here by
+	cpu_init_fpu, so no C code ever runs with them half configured. The
+	kernel is still compiled for scalar code; SIMD routines bracket
+	themselves with kernel_fpu_begin and kernel_fpu_end. The GDT should
+	be loaded here. Paging is enabled by kernel_main as soon as the
+	physical memory manager knows how much RAM to map. C++ features such
+	as global constructors and exceptions will require runtime support to
+	work as well.
+
+	The stack is still 16-byte aligned here, so the call is well defined.
+	EAX (the multiboot magic, see below) is not preserved across C calls,
+	so it is parked in ESI, which is; EBX is callee-saved as well.
 	*/
+	mov %eax, %esi
+	call cpu_init_fpu
+	mov %esi, %eax
 
 	/*
 	Enter the high-level kernel. The ABI requires the stack is 16-byte
 	aligned at the time of the call instruction (which afterwards pushes
 	the return pointer of size 4 bytes). The stack was originally 16-byte
 	aligned above and we've pushed a multiple of 16 bytes to the
-	stack since (pushed 0 bytes so far), so the alignment has thus been
-	preserved and the call is well defined.
+	stack since (8 bytes of padding plus the two arguments below), so the
+	alignment has thus been preserved and the call is well defined.
+
+	GRUB leaves the multiboot magic in EAX and the physical address of the
+	boot information structure in EBX. They are passed on as
+	kernel_main(magic, info) so the kernel can find its modules.
 	*/
+	sub $8, %esp
+	push %ebx
+	push %eax
 	call kernel_main
 
 	/*
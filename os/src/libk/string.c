@@ -0,0 +1,302 @@
+#include "string.h"
+#include <stdint.h>
+#include "cpu.h"
+
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+/*
+ * Strings are scanned a 32-bit word at a time: (w - 0x01010101) & ~w &
+ * 0x80808080 is non-zero exactly when some byte of w is zero. Words are only
+ * read from aligned addresses, so reading past a terminator never crosses
+ * into the next page. Copies and fills move dwords with rep movsl/stosl, and
+ * blocks of SSE_MIN_BYTES or more go 64 bytes per step through SSE2
+ * registers inside a kernel_fpu_begin/kernel_fpu_end section.
+ *
+ * memcpy, memmove and memset are written with inline assembly so GCC cannot
+ * turn their loops back into calls to themselves.
+ */
+#define SSE_MIN_BYTES 256
+#define ONES 0x01010101u
+#define HIGHS 0x80808080u
+
+typedef uint32_t __attribute__((may_alias)) aligned_word;
+typedef uint32_t __attribute__((may_alias, aligned(1))) unaligned_word;
+typedef char byte_vector __attribute__((vector_size(16), may_alias));
+typedef char unaligned_byte_vector __attribute__((vector_size(16), aligned(1), may_alias));
+
+static inline uint32_t has_zero(uint32_t word)
+{
+        return (word - ONES) & ~word & HIGHS;
+}
+
+static void copy_forward(char* dest, const char* src, size_t len)
+{
+        size_t words = len / 4;
+        size_t bytes = len % 4;
+
+        __asm__ volatile("rep movsl" : "+D"(dest), "+S"(src), "+c"(words) : : "memory");
+        __asm__ volatile("rep movsb" : "+D"(dest), "+S"(src), "+c"(bytes) : : "memory");
+}
+
+// Copy len bytes ending at dest_end/src_end, highest address first.
+static void copy_backward(char* dest_end, const char* src_end, size_t len)
+{
+        size_t words = len / 4;
+        size_t bytes = len % 4;
+        char* dest = dest_end - 1;
+        const char* src = src_end - 1;
+
+        __asm__ volatile("std\n\trep movsb\n\tcld" : "+D"(dest), "+S"(src), "+c"(bytes) : : "memory");
+
+        // Now one below the odd tail bytes; movsl addresses the dword's low byte.
+        dest -= 3;
+        src -= 3;
+        __asm__ volatile("std\n\trep movsl\n\tcld" : "+D"(dest), "+S"(src), "+c"(words) : : "memory");
+}
+
+// dest must be 16-byte aligned. Returns the number of bytes copied.
+__attribute__((target("sse2")))
+static size_t copy_sse2(char* dest, const char* src, size_t len)
+{
+        size_t done = 0;
+
+        // All four loads come before the stores, so a forward overlapping
+        // move (dest below src) never reads bytes it has already written.
+        for (; done + 64 <= len; done += 64) {
+                byte_vector a = *(const unaligned_byte_vector*)(src + done);
+                byte_vector b = *(const unaligned_byte_vector*)(src + done + 16);
+                byte_vector c = *(const unaligned_byte_vector*)(src + done + 32);
+                byte_vector d = *(const unaligned_byte_vector*)(src + done + 48);
+
+                *(byte_vector*)(dest + done) = a;
+                *(byte_vector*)(dest + done + 16) = b;
+                *(byte_vector*)(dest + done + 32) = c;
+                *(byte_vector*)(dest + done + 48) = d;
+        }
+
+        return done;
+}
+
+// dest must be 16-byte aligned. Returns the number of bytes filled.
+__attribute__((target("sse2")))
+static size_t fill_sse2(char* dest, unsigned char value, size_t len)
+{
+        byte_vector pattern = { 0 };
+        size_t done = 0;
+
+        pattern += (char)value;
+
+        for (; done + 64 <= len; done += 64) {
+                *(byte_vector*)(dest + done) = pattern;
+                *(byte_vector*)(dest + done + 16) = pattern;
+                *(byte_vector*)(dest + done + 32) = pattern;
+                *(byte_vector*)(dest + done + 48) = pattern;
+        }
+
+        return done;
+}
+
+static size_t align_gap(const char* address)
+{
+        return (16 - ((uintptr_t)address & 15)) & 15;
+}
+
+void* memcpy(void* dest, const void* src, size_t len)
+{
+        char* d = dest;
+        const char* s = src;
+
+        if (len >= SSE_MIN_BYTES && kernel_fpu_begin()) {
+                size_t head = align_gap(d);
+                size_t done;
+
+                copy_forward(d, s, head);
+                done = head + copy_sse2(d + head, s + head, len - head);
+                kernel_fpu_end();
+                d += done;
+                s += done;
+                len -= done;
+        }
+
+        copy_forward(d, s, len);
+        return dest;
+}
+
+void* memmove(void* dest, const void* src, size_t len)
+{
+        char* d = dest;
+        const char* s = src;
+
+        if (d == s || len == 0) {
+                return dest;
+        }
+
+        // Forward copies are safe whenever dest starts below src.
+        if (d < s || d >= s + len) {
+                return memcpy(dest, src, len);
+        }
+
+        copy_backward(d + len, s + len, len);
+        return dest;
+}
+
+void* memset(void* dest, int value, size_t len)
+{
+        char* d = dest;
+        uint32_t pattern = (unsigned char)value * ONES;
+        size_t words;
+        size_t bytes;
+
+        if (len >= SSE_MIN_BYTES && kernel_fpu_begin()) {
+                size_t head = align_gap(d);
+                size_t done;
+
+                bytes = head;
+                __asm__ volatile("rep stosb" : "+D"(d), "+c"(bytes) : "a"(pattern) : "memory");
+                done = fill_sse2(d, (unsigned char)value, len - head);
+                kernel_fpu_end();
+                d += done;
+                len -= head + done;
+        }
+
+        words = len / 4;
+        bytes = len % 4;
+        __asm__ volatile("rep stosl" : "+D"(d), "+c"(words) : "a"(pattern) : "memory");
+        __asm__ volatile("rep stosb" : "+D"(d), "+c"(bytes) : "a"(pattern) : "memory");
+        return dest;
+}
+
+int memcmp(const void* a, const void* b, size_t len)
+{
+        const unsigned char* x = a;
+        const unsigned char* y = b;
+
+        while (len >= 4 && *(const unaligned_word*)x == *(const unaligned_word*)y) {
+                x += 4;
+                y += 4;
+                len -= 4;
+        }
+
+        for (; len > 0; --len, ++x, ++y) {
+                if (*x != *y) {
+                        return *x - *y;
+                }
+        }
+
+        return 0;
+}
+
+void* memchr(const void* src, int value, size_t len)
+{
+        const unsigned char* p = src;
+        unsigned char c = (unsigned char)value;
+        uint32_t pattern = c * ONES;
+
+        for (; len > 0 && ((uintptr_t)p & 3); --len, ++p) {
+                if (*p == c) {
+                        return (void*)p;
+                }
+        }
+
+        // XOR turns matching bytes into zero bytes.
+        for (; len >= 4 && !has_zero(*(const aligned_word*)p ^ pattern); len -= 4) {
+                p += 4;
+        }
+
+        for (; len > 0; --len, ++p) {
+                if (*p == c) {
+                        return (void*)p;
+                }
+        }
+
+        return NULL;
+}
+
+size_t strlen(const char* str)
+{
+        const char* p = str;
+
+        for (; (uintptr_t)p & 3; ++p) {
+                if (*p == '\0') {
+                        return (size_t)(p - str);
+                }
+        }
+
+        while (!has_zero(*(const aligned_word*)p)) {
+                p += 4;
+        }
+
+        while (*p != '\0') {
+                ++p;
+        }
+
+        return (size_t)(p - str);
+}
+
+size_t strnlen(const char* str, size_t max_len)
+{
+        const char* end = memchr(str, '\0', max_len);
+
+        return end ? (size_t)(end - str) : max_len;
+}
+
+int strcmp(const char* a, const char* b)
+{
+        const unsigned char* x = (const unsigned char*)a;
+        const unsigned char* y = (const unsigned char*)b;
+
+        // Word steps need both strings at the same alignment.
+        if ((((uintptr_t)x ^ (uintptr_t)y) & 3) == 0) {
+                for (; (uintptr_t)x & 3; ++x, ++y) {
+                        if (*x != *y || *x == '\0') {
+                                return *x - *y;
+                        }
+                }
+
+                while (*(const aligned_word*)x == *(const aligned_word*)y && !has_zero(*(const aligned_word*)x)) {
+                        x += 4;
+                        y += 4;
+                }
+        }
+
+        while (*x != '\0' && *x == *y) {
+                ++x;
+                ++y;
+        }
+
+        return *x - *y;
+}
+
+int strncmp(const char* a, const char* b, size_t len)
+{
+        const unsigned char* x = (const unsigned char*)a;
+        const unsigned char* y = (const unsigned char*)b;
+
+        for (; len > 0; --len, ++x, ++y) {
+                if (*x != *y || *x == '\0') {
+                        return *x - *y;
+                }
+        }
+
+        return 0;
+}
+
+size_t strlcpy(char* dest, const char* src, size_t size)
+{
+        size_t len = strlen(src);
+
+        if (size > 0) {
+                size_t copied = len < size - 1 ? len : size - 1;
+
+                memcpy(dest, src, copied);
+                dest[copied] = '\0';
+        }
+
+        return len;
+}
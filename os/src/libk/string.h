@@ -0,0 +1,30 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_LIBK_STRING_H
+#define ENZOS_LIBK_STRING_H
+
+#include <stddef.h>
+
+/*
+ * The kernel's string and memory routines. They keep the standard names and
+ * semantics because GCC emits calls to memcpy, memmove, memset and memcmp on
+ * its own, even in freestanding code. None of them accept NULL.
+ */
+void* memcpy(void* dest, const void* src, size_t len);
+void* memmove(void* dest, const void* src, size_t len);
+void* memset(void* dest, int value, size_t len);
+int memcmp(const void* a, const void* b, size_t len);
+void* memchr(const void* src, int value, size_t len);
+
+size_t strlen(const char* str);
+size_t strnlen(const char* str, size_t max_len);
+int strcmp(const char* a, const char* b);
+int strncmp(const char* a, const char* b, size_t len);
+
+/*
+ * Copy at most size - 1 bytes of src and always terminate dest (unless size
+ * is 0). Returns strlen(src), so truncation shows as a result >= size.
+ */
+size_t strlcpy(char* dest, const char* src, size_t size);
+
+#endif /* ENZOS_LIBK_STRING_H */
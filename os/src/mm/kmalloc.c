@@ -0,0 +1,276 @@
+#include "kmalloc.h"
+#include <stdint.h>
+#include "pmm.h"
+
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+/*
+ * Every slab is one frame: a Slab header followed by equal-sized objects, the
+ * free ones chained through their first word. Because objects never start on
+ * a frame boundary, kfree tells slab objects from large blocks by alignment
+ * alone and finds the header by masking the address. Slabs with free objects
+ * sit on their cache's partial list; full slabs are on no list. One empty
+ * slab per cache is kept back so a loop of kmalloc/kfree does not bounce a
+ * frame through the buddy allocator.
+ */
+typedef struct Slab {
+        struct KmemCache* cache;
+        struct Slab* next;
+        struct Slab* prev;
+        void* free_objects;
+        unsigned int in_use;
+} Slab;
+
+typedef struct KmemCache {
+        size_t object_size;
+        size_t first_offset; // header rounded up so small objects stay aligned
+        size_t per_slab;
+        Slab* partial;
+        Slab* spare;
+        size_t slabs;
+        size_t objects;
+} KmemCache;
+
+static KmemCache caches[KMALLOC_CLASSES];
+static KmallocStats stats;
+static int caches_ready = 0;
+
+static void init_caches(void)
+{
+        for (size_t i = 0; i < KMALLOC_CLASSES; ++i) {
+                KmemCache* cache = &caches[i];
+                size_t align = KMALLOC_MIN_SIZE << i;
+
+                if (align > 64) {
+                        align = 64;
+                }
+
+                cache->object_size = KMALLOC_MIN_SIZE << i;
+                cache->first_offset = (sizeof(Slab) + align - 1) & ~(align - 1);
+                cache->per_slab = (PMM_FRAME_SIZE - cache->first_offset) / cache->object_size;
+                cache->partial = NULL;
+                cache->spare = NULL;
+                cache->slabs = 0;
+                cache->objects = 0;
+        }
+
+        caches_ready = 1;
+}
+
+static size_t class_of(size_t size)
+{
+        if (size <= KMALLOC_MIN_SIZE) {
+                return 0;
+        }
+
+        // Index of the next power of two, counted from KMALLOC_MIN_SIZE.
+        return (size_t)(32 - __builtin_clz((unsigned int)(size - 1))) - 4;
+}
+
+static void partial_push(KmemCache* cache, Slab* slab)
+{
+        slab->prev = NULL;
+        slab->next = cache->partial;
+
+        if (slab->next) {
+                slab->next->prev = slab;
+        }
+
+        cache->partial = slab;
+}
+
+static void partial_unlink(KmemCache* cache, Slab* slab)
+{
+        if (slab->prev) {
+                slab->prev->next = slab->next;
+        } else {
+                cache->partial = slab->next;
+        }
+
+        if (slab->next) {
+                slab->next->prev = slab->prev;
+        }
+
+        slab->next = NULL;
+        slab->prev = NULL;
+}
+
+static Slab* grow_cache(KmemCache* cache)
+{
+        uintptr_t frame = pmm_alloc(0);
+        Slab* slab;
+        char* object;
+
+        if (!frame) {
+                return NULL;
+        }
+
+        slab = (Slab*)frame;
+        slab->cache = cache;
+        slab->in_use = 0;
+        slab->free_objects = NULL;
+
+        // Thread the free list back to front so objects go out in address order.
+        object = (char*)frame + cache->first_offset + (cache->per_slab - 1) * cache->object_size;
+
+        for (size_t i = 0; i < cache->per_slab; ++i, object -= cache->object_size) {
+                *(void**)object = slab->free_objects;
+                slab->free_objects = object;
+        }
+
+        cache->slabs++;
+        return slab;
+}
+
+static void* alloc_large(size_t size)
+{
+        unsigned int order = 0;
+        uintptr_t block;
+
+        while (order <= PMM_MAX_ORDER && ((size_t)PMM_FRAME_SIZE << order) < size) {
+                ++order;
+        }
+
+        block = order <= PMM_MAX_ORDER ? pmm_alloc(order) : 0;
+
+        if (!block) {
+                return NULL;
+        }
+
+        stats.large_blocks++;
+        stats.large_frames += 1u << order;
+        return (void*)block;
+}
+
+void* kmalloc(size_t size)
+{
+        KmemCache* cache;
+        Slab* slab;
+        void* object;
+
+        if (size == 0) {
+                return NULL;
+        }
+
+        if (!caches_ready) {
+                init_caches();
+        }
+
+        if (size > KMALLOC_MAX_SLAB_SIZE) {
+                object = alloc_large(size);
+        } else {
+                cache = &caches[class_of(size)];
+                slab = cache->partial;
+
+                if (!slab) {
+                        slab = cache->spare;
+                        cache->spare = NULL;
+
+                        if (!slab) {
+                                slab = grow_cache(cache);
+                        }
+
+                        if (slab) {
+                                partial_push(cache, slab);
+                        }
+                }
+
+                object = NULL;
+
+                if (slab) {
+                        object = slab->free_objects;
+                        slab->free_objects = *(void**)object;
+                        slab->in_use++;
+                        cache->objects++;
+
+                        if (!slab->free_objects) {
+                                partial_unlink(cache, slab);
+                        }
+                }
+        }
+
+        if (!object) {
+                stats.failures++;
+                return NULL;
+        }
+
+        stats.allocations++;
+        return object;
+}
+
+void kfree(void* ptr)
+{
+        uintptr_t address = (uintptr_t)ptr;
+        KmemCache* cache;
+        Slab* slab;
+
+        if (!ptr) {
+                return;
+        }
+
+        if (address % PMM_FRAME_SIZE == 0) {
+                int order = pmm_block_order(address);
+
+                if (order < 0) {
+                        return;
+                }
+
+                stats.large_blocks--;
+                stats.large_frames -= 1u << order;
+                stats.frees++;
+                pmm_free(address);
+                return;
+        }
+
+        slab = (Slab*)(address & ~(uintptr_t)(PMM_FRAME_SIZE - 1));
+        cache = slab->cache;
+
+        if (!slab->free_objects) {
+                partial_push(cache, slab); // was full
+        }
+
+        *(void**)ptr = slab->free_objects;
+        slab->free_objects = ptr;
+        slab->in_use--;
+        cache->objects--;
+        stats.frees++;
+
+        if (slab->in_use > 0) {
+                return;
+        }
+
+        partial_unlink(cache, slab);
+
+        if (!cache->spare) {
+                cache->spare = slab;
+        } else {
+                cache->slabs--;
+                pmm_free((uintptr_t)slab);
+        }
+}
+
+void kmalloc_get_stats(KmallocStats* out)
+{
+        if (!out) {
+                return;
+        }
+
+        if (!caches_ready) {
+                init_caches();
+        }
+
+        *out = stats;
+
+        for (size_t i = 0; i < KMALLOC_CLASSES; ++i) {
+                out->caches[i].object_size = caches[i].object_size;
+                out->caches[i].slabs = caches[i].slabs;
+                out->caches[i].objects = caches[i].objects;
+                out->caches[i].capacity = caches[i].slabs * caches[i].per_slab;
+        }
+}
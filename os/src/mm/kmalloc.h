@@ -0,0 +1,41 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_MM_KMALLOC_H
+#define ENZOS_MM_KMALLOC_H
+
+#include <stddef.h>
+
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SLAB_SIZE 1024 /* larger requests take whole buddy blocks */
+#define KMALLOC_CLASSES 7          /* 16, 32, ... 1024 bytes */
+
+typedef struct {
+        size_t object_size;
+        size_t slabs;   /* frames owned by the cache, empty spare included */
+        size_t objects; /* objects handed out */
+        size_t capacity; /* objects the cache's slabs can hold */
+} KmallocCacheStats;
+
+typedef struct {
+        size_t allocations;
+        size_t frees;
+        size_t failures;
+        size_t large_blocks;
+        size_t large_frames;
+        KmallocCacheStats caches[KMALLOC_CLASSES];
+} KmallocStats;
+
+/*
+ * Allocate size bytes from the kernel heap. Requests up to
+ * KMALLOC_MAX_SLAB_SIZE come from the slab cache of the next power of two;
+ * larger ones get their own frame-aligned buddy block. Returns NULL when
+ * size is 0 or memory runs out.
+ */
+void* kmalloc(size_t size);
+
+/* Free memory from kmalloc. NULL is ignored. */
+void kfree(void* ptr);
+
+void kmalloc_get_stats(KmallocStats* out);
+
+#endif /* ENZOS_MM_KMALLOC_H */
@@ -0,0 +1,127 @@
+#include "paging.h"
+#include <cpuid.h>
+#include <stdint.h>
+#include "pmm.h"
+
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+#define PAGE_PRESENT (1u << 0)
+#define PAGE_WRITABLE (1u << 1)
+#define PAGE_LARGE (1u << 7) /* PDE maps 4 MiB directly (PSE) */
+
+#define PAGE_SIZE 4096u
+#define LARGE_PAGE_SIZE (4u << 20)
+#define PAGE_ENTRIES 1024
+
+#define CPUID_EDX_PSE (1u << 3)
+#define CR4_PSE (1u << 4)
+#define CR0_PG (1u << 31)
+
+/*
+ * One page below the boot stack, reserved by linker.ld (which asserts it lies
+ * in the low 4 MiB) and never mapped. With no IDT installed, touching it
+ * triple-faults and resets the machine rather than reporting the overflow.
+ */
+extern char __stack_guard[];
+
+static uint32_t page_directory[PAGE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static uint32_t low_table[PAGE_ENTRIES] __attribute__((aligned(PAGE_SIZE)));
+static size_t mapped_regions = 0;
+static bool enabled = false;
+
+static bool cpu_has_pse(void)
+{
+        unsigned int eax, ebx, ecx, edx;
+
+        return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (edx & CPUID_EDX_PSE);
+}
+
+/*
+ * Identity-map the 4 KiB pages of one 4 MiB region, leaving the NULL page
+ * and the stack guard out. Without PSE every region needs such a table.
+ */
+static void fill_table(uint32_t* table, uint32_t base)
+{
+        for (uint32_t i = 0; i < PAGE_ENTRIES; ++i) {
+                uint32_t address = base + i * PAGE_SIZE;
+
+                if (address == 0 || address == (uint32_t)(uintptr_t)__stack_guard) {
+                        table[i] = 0;
+                } else {
+                        table[i] = address | PAGE_WRITABLE | PAGE_PRESENT;
+                }
+        }
+}
+
+bool paging_init(void)
+{
+        size_t regions = (pmm_frame_limit() + LARGE_PAGE_SIZE / PMM_FRAME_SIZE - 1) / (LARGE_PAGE_SIZE / PMM_FRAME_SIZE);
+        bool pse = cpu_has_pse();
+        uintptr_t cr0;
+        uintptr_t cr4;
+
+        // The low 4 MiB hold the kernel, so they are always mapped. Without a
+        // memory map, map the whole 32-bit space rather than guess.
+        if (regions == 0 || regions > PAGE_ENTRIES) {
+                regions = PAGE_ENTRIES;
+        }
+
+        fill_table(low_table, 0);
+        page_directory[0] = (uint32_t)(uintptr_t)low_table | PAGE_WRITABLE | PAGE_PRESENT;
+
+        for (size_t i = 1; i < PAGE_ENTRIES; ++i) {
+                uint32_t base = (uint32_t)(i * LARGE_PAGE_SIZE);
+
+                page_directory[i] = 0;
+
+                if (i >= regions) {
+                        continue;
+                }
+
+                if (pse) {
+                        page_directory[i] = base | PAGE_LARGE | PAGE_WRITABLE | PAGE_PRESENT;
+                } else {
+                        // Tables come from frames that are identity-mapped below.
+                        uint32_t* table = (uint32_t*)pmm_alloc(0);
+
+                        if (!table) {
+                                return false;
+                        }
+
+                        fill_table(table, base);
+                        page_directory[i] = (uint32_t)(uintptr_t)table | PAGE_WRITABLE | PAGE_PRESENT;
+                }
+        }
+
+        if (pse) {
+                __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+                cr4 |= CR4_PSE;
+                __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+        }
+
+        __asm__ volatile("mov %0, %%cr3" : : "r"(page_directory) : "memory");
+
+        __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+        cr0 |= CR0_PG;
+        __asm__ volatile("mov %0, %%cr0" : : "r"(cr0) : "memory");
+
+        mapped_regions = regions;
+        enabled = true;
+        return true;
+}
+
+bool paging_enabled(void)
+{
+        return enabled;
+}
+
+size_t paging_mapped_mib(void)
+{
+        return mapped_regions * (LARGE_PAGE_SIZE >> 20);
+}
@@ -0,0 +1,23 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_MM_PAGING_H
+#define ENZOS_MM_PAGING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Identity-map physical memory and turn paging on. Everything is mapped with
+ * 4 MiB pages when the CPU has PSE, except the first 4 MiB: it gets a 4 KiB
+ * page table so that page 0 (NULL) and the guard page under the boot stack
+ * can stay unmapped. Call after pmm_init, which says how far RAM reaches.
+ * Returns false if there was no memory for the page tables.
+ */
+bool paging_init(void);
+
+bool paging_enabled(void);
+
+/* MiB of address space identity-mapped, starting at 0. */
+size_t paging_mapped_mib(void);
+
+#endif /* ENZOS_MM_PAGING_H */
@@ -0,0 +1,425 @@
+#include "pmm.h"
+#include <stdbool.h>
+#include "libk/string.h"
+
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+#define LOW_MEMORY_END 0x100000u
+/*
+ * Low memory, kernel, info block, command line, memory map, module list and
+ * frame table, plus each module and its string.
+ */
+#define MAX_RESERVED (7 + 2 * PMM_MAX_MODULES)
+
+/*
+ * One byte of state per frame, indexed by frame number. Only the first frame
+ * of a block carries its state; the rest of the block, and every frame the
+ * allocator does not own, read as zero.
+ */
+#define FRAME_FREE  0x80 /* first frame of a block on a free list */
+#define FRAME_USED  0x40 /* first frame of a block handed out by pmm_alloc */
+#define FRAME_ORDER 0x0f
+
+// Free blocks are linked through their own first frame.
+typedef struct FreeBlock {
+        struct FreeBlock* next;
+        struct FreeBlock* prev;
+} FreeBlock;
+
+typedef struct {
+        uint64_t start;
+        uint64_t end;
+} Range;
+
+extern char __kernel_start[];
+extern char __kernel_end[];
+
+static uint8_t* frame_state = NULL;
+static uint32_t frame_limit = 0;
+static FreeBlock* free_lists[PMM_MAX_ORDER + 1];
+static size_t free_counts[PMM_MAX_ORDER + 1];
+static size_t total_frames = 0;
+static size_t free_frames = 0;
+
+static Range reserved[MAX_RESERVED];
+static size_t reserved_count = 0;
+static bool reserved_overflow = false;
+
+// Scratch state for pmm_init's passes over the memory map.
+static uint64_t highest_usable = 0;
+static uint64_t table_address = 0;
+
+static FreeBlock* block_at(uint32_t frame)
+{
+        return (FreeBlock*)((uintptr_t)frame * PMM_FRAME_SIZE);
+}
+
+static void push_block(uint32_t frame, unsigned int order)
+{
+        FreeBlock* block = block_at(frame);
+
+        block->prev = NULL;
+        block->next = free_lists[order];
+
+        if (block->next) {
+                block->next->prev = block;
+        }
+
+        free_lists[order] = block;
+        ++free_counts[order];
+        frame_state[frame] = FRAME_FREE | order;
+}
+
+static void unlink_block(uint32_t frame, unsigned int order)
+{
+        FreeBlock* block = block_at(frame);
+
+        if (block->prev) {
+                block->prev->next = block->next;
+        } else {
+                free_lists[order] = block->next;
+        }
+
+        if (block->next) {
+                block->next->prev = block->prev;
+        }
+
+        --free_counts[order];
+        frame_state[frame] = 0;
+}
+
+static void reserve(uint64_t start, uint64_t end)
+{
+        size_t i;
+
+        if (start >= end) {
+                return;
+        }
+
+        if (reserved_count >= MAX_RESERVED) {
+                reserved_overflow = true;
+                return;
+        }
+
+        // Keep the list sorted by start so carving regions is a single pass.
+        for (i = reserved_count; i > 0 && reserved[i - 1].start > start; --i) {
+                reserved[i] = reserved[i - 1];
+        }
+
+        reserved[i].start = start;
+        reserved[i].end = end;
+        ++reserved_count;
+}
+
+// Move start past every reserved range it overlaps for a span of size bytes.
+static uint64_t skip_reserved(uint64_t start, uint64_t size)
+{
+        for (size_t i = 0; i < reserved_count; ++i) {
+                if (reserved[i].start < start + size && start < reserved[i].end) {
+                        start = (reserved[i].end + PMM_FRAME_SIZE - 1) & ~(uint64_t)(PMM_FRAME_SIZE - 1);
+                }
+        }
+
+        return start;
+}
+
+/*
+ * Hand the whole frames inside [start, end) to the free lists, each as the
+ * largest naturally aligned block that still fits.
+ */
+static void add_free_range(uint64_t start, uint64_t end)
+{
+        uint32_t frame = (uint32_t)((start + PMM_FRAME_SIZE - 1) / PMM_FRAME_SIZE);
+        uint32_t last = (uint32_t)(end / PMM_FRAME_SIZE);
+
+        if (last > frame_limit) {
+                last = frame_limit;
+        }
+
+        while (frame < last) {
+                unsigned int order = PMM_MAX_ORDER;
+
+                while (order > 0 && ((frame & ((1u << order) - 1)) || frame + (1u << order) > last)) {
+                        --order;
+                }
+
+                if (frame_state[frame] == 0) {
+                        push_block(frame, order);
+                        free_frames += 1u << order;
+                }
+
+                frame += 1u << order;
+        }
+}
+
+static void add_usable(uint64_t start, uint64_t end)
+{
+        for (size_t i = 0; i < reserved_count && start < end; ++i) {
+                if (reserved[i].end <= start) {
+                        continue;
+                }
+
+                if (reserved[i].start >= end) {
+                        break;
+                }
+
+                if (reserved[i].start > start) {
+                        add_free_range(start, reserved[i].start);
+                }
+
+                start = reserved[i].end;
+        }
+
+        if (start < end) {
+                add_free_range(start, end);
+        }
+}
+
+/*
+ * Walk the usable RAM GRUB reported, calling fn on each region clipped to the
+ * 32-bit physical address space. Without a memory map, fall back to the
+ * single region mem_upper describes above 1 MiB.
+ */
+static void for_each_usable(const multiboot_info_t* info, void (*fn)(uint64_t start, uint64_t end))
+{
+        const uint64_t limit = 0x100000000ull;
+
+        if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+                uintptr_t entry = info->mmap_addr;
+                uintptr_t end = entry + info->mmap_length;
+
+                while (entry < end) {
+                        const multiboot_mmap_entry_t* region = (const multiboot_mmap_entry_t*)entry;
+
+                        if (region->type == MULTIBOOT_MEMORY_AVAILABLE && region->addr < limit) {
+                                uint64_t region_end = region->addr + region->len;
+
+                                fn(region->addr, region_end < limit ? region_end : limit);
+                        }
+
+                        entry += region->size + sizeof(region->size);
+                }
+        } else if (info->flags & MULTIBOOT_INFO_MEMORY) {
+                fn(LOW_MEMORY_END, LOW_MEMORY_END + (uint64_t)info->mem_upper * 1024);
+        }
+}
+
+static void note_highest(uint64_t start, uint64_t end)
+{
+        (void)start;
+
+        if (end > highest_usable) {
+                highest_usable = end;
+        }
+}
+
+// First fit for the frame table: the lowest usable span clear of reservations.
+static void place_table(uint64_t start, uint64_t end)
+{
+        uint64_t size = frame_limit;
+
+        if (table_address != 0) {
+                return;
+        }
+
+        start = (start + PMM_FRAME_SIZE - 1) & ~(uint64_t)(PMM_FRAME_SIZE - 1);
+
+        for (;;) {
+                uint64_t moved = skip_reserved(start, size);
+
+                if (moved == start) {
+                        break;
+                }
+
+                start = moved;
+        }
+
+        if (start + size <= end) {
+                table_address = start;
+        }
+}
+
+size_t pmm_init(uint32_t magic, const multiboot_info_t* info)
+{
+        for (unsigned int order = 0; order <= PMM_MAX_ORDER; ++order) {
+                free_lists[order] = NULL;
+                free_counts[order] = 0;
+        }
+
+        frame_state = NULL;
+        frame_limit = 0;
+        total_frames = 0;
+        free_frames = 0;
+        reserved_count = 0;
+        reserved_overflow = false;
+        highest_usable = 0;
+        table_address = 0;
+
+        if (magic != MULTIBOOT_BOOTLOADER_MAGIC || !info) {
+                return 0;
+        }
+
+        // Frame 0 doubles as the failure value, so the low 1 MiB (BIOS data,
+        // the VGA buffer, option ROMs) is never handed out.
+        reserve(0, LOW_MEMORY_END);
+        reserve((uintptr_t)__kernel_start, (uintptr_t)__kernel_end);
+        reserve((uintptr_t)info, (uintptr_t)info + sizeof(*info));
+
+        if (info->flags & MULTIBOOT_INFO_CMDLINE) {
+                reserve(info->cmdline, info->cmdline + (uint64_t)strlen((const char*)(uintptr_t)info->cmdline) + 1);
+        }
+
+        if (info->flags & MULTIBOOT_INFO_MEM_MAP) {
+                reserve(info->mmap_addr, (uint64_t)info->mmap_addr + info->mmap_length);
+        }
+
+        // Modules, the initrd among them, are used in place.
+        if ((info->flags & MULTIBOOT_INFO_MODS) && info->mods_count > 0) {
+                const multiboot_module_t* modules = (const multiboot_module_t*)(uintptr_t)info->mods_addr;
+
+                reserve(info->mods_addr, info->mods_addr + (uint64_t)info->mods_count * sizeof(*modules));
+
+                for (uint32_t i = 0; i < info->mods_count; ++i) {
+                        reserve(modules[i].mod_start, modules[i].mod_end);
+
+                        if (modules[i].string) {
+                                const char* string = (const char*)(uintptr_t)modules[i].string;
+
+                                reserve(modules[i].string, modules[i].string + (uint64_t)strlen(string) + 1);
+                        }
+                }
+        }
+
+        // A dropped reservation could hand a module out as free memory.
+        if (reserved_overflow) {
+                return 0;
+        }
+
+        for_each_usable(info, note_highest);
+        frame_limit = (uint32_t)(highest_usable / PMM_FRAME_SIZE);
+
+        if (frame_limit == 0) {
+                return 0;
+        }
+
+        for_each_usable(info, place_table);
+
+        if (table_address == 0) {
+                frame_limit = 0;
+                return 0;
+        }
+
+        frame_state = (uint8_t*)(uintptr_t)table_address;
+
+        for (uint32_t frame = 0; frame < frame_limit; ++frame) {
+                frame_state[frame] = 0;
+        }
+
+        reserve(table_address, table_address + frame_limit);
+
+        if (reserved_overflow) {
+                frame_limit = 0;
+                return 0;
+        }
+
+        for_each_usable(info, add_usable);
+        total_frames = free_frames;
+        return free_frames;
+}
+
+uintptr_t pmm_alloc(unsigned int order)
+{
+        unsigned int found = order;
+        uint32_t frame;
+
+        if (order > PMM_MAX_ORDER) {
+                return 0;
+        }
+
+        while (found <= PMM_MAX_ORDER && !free_lists[found]) {
+                ++found;
+        }
+
+        if (found > PMM_MAX_ORDER) {
+                return 0;
+        }
+
+        frame = (uint32_t)((uintptr_t)free_lists[found] / PMM_FRAME_SIZE);
+        unlink_block(frame, found);
+
+        // Split down to the requested size, freeing the upper halves.
+        while (found > order) {
+                --found;
+                push_block(frame + (1u << found), found);
+        }
+
+        frame_state[frame] = FRAME_USED | order;
+        free_frames -= 1u << order;
+        return (uintptr_t)frame * PMM_FRAME_SIZE;
+}
+
+void pmm_free(uintptr_t address)
+{
+        uint32_t frame = (uint32_t)(address / PMM_FRAME_SIZE);
+        unsigned int order;
+
+        if (address % PMM_FRAME_SIZE != 0 || frame >= frame_limit || !(frame_state[frame] & FRAME_USED)) {
+                return;
+        }
+
+        order = frame_state[frame] & FRAME_ORDER;
+        frame_state[frame] = 0;
+        free_frames += 1u << order;
+
+        // Merge with the buddy for as long as it is free and the same size.
+        while (order < PMM_MAX_ORDER) {
+                uint32_t buddy = frame ^ (1u << order);
+
+                if (buddy >= frame_limit || frame_state[buddy] != (FRAME_FREE | order)) {
+                        break;
+                }
+
+                unlink_block(buddy, order);
+                frame &= ~(1u << order);
+                ++order;
+        }
+
+        push_block(frame, order);
+}
+
+int pmm_block_order(uintptr_t address)
+{
+        uint32_t frame = (uint32_t)(address / PMM_FRAME_SIZE);
+
+        if (address % PMM_FRAME_SIZE != 0 || frame >= frame_limit || !(frame_state[frame] & FRAME_USED)) {
+                return -1;
+        }
+
+        return frame_state[frame] & FRAME_ORDER;
+}
+
+size_t pmm_frame_limit(void)
+{
+        return frame_limit;
+}
+
+size_t pmm_total_frames(void)
+{
+        return total_frames;
+}
+
+size_t pmm_free_frames(void)
+{
+        return free_frames;
+}
+
+size_t pmm_free_blocks(unsigned int order)
+{
+        return order <= PMM_MAX_ORDER ? free_counts[order] : 0;
+}
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_MM_PMM_H
+#define ENZOS_MM_PMM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include "multiboot.h"
+
+#define PMM_FRAME_SIZE 4096
+#define PMM_MAX_ORDER 10 /* largest block is 2^10 frames, 4 MiB */
+#define PMM_MAX_MODULES 16
+
+/*
+ * Build the free lists from the multiboot memory map (or mem_upper when GRUB
+ * gave no map). The low 1 MiB, the kernel image, the boot information and
+ * command line, every module and its string, and the allocator's own frame
+ * table stay reserved. Returns the number of free frames. With more than
+ * PMM_MAX_MODULES modules not every reservation can be recorded, so nothing
+ * is handed out and 0 is returned rather than risk giving away a module.
+ */
+size_t pmm_init(uint32_t magic, const multiboot_info_t* info);
+
+/*
+ * Allocate 2^order physically contiguous frames aligned to their size.
+ * Returns the physical address of the first frame, or 0 when no block is
+ * large enough (frame 0 is never handed out).
+ */
+uintptr_t pmm_alloc(unsigned int order);
+
+/* Return a block from pmm_alloc; its order was recorded when it was handed out. */
+void pmm_free(uintptr_t address);
+
+/* Order of the allocated block starting at address, or -1 if there is none. */
+int pmm_block_order(uintptr_t address);
+
+/*
+ * Frame number just past the highest usable RAM below 4 GiB, or 0 before
+ * pmm_init. A frame count, since 4 GiB itself does not fit in uintptr_t.
+ */
+size_t pmm_frame_limit(void);
+
+size_t pmm_total_frames(void);
+size_t pmm_free_frames(void);
+size_t pmm_free_blocks(unsigned int order);
+
+#endif /* ENZOS_MM_PMM_H */
@@ -0,0 +1,53 @@
+// SPDX-License-Identifier: MIT
+
+#ifndef ENZOS_MULTIBOOT_H
+#define ENZOS_MULTIBOOT_H
+
+#include <stdint.h>
+
+/* Value GRUB leaves in EAX when it hands control to a Multiboot kernel. */
+#define MULTIBOOT_BOOTLOADER_MAGIC 0x2BADB002
+
+/* Bits in multiboot_info.flags that say which fields are valid. */
+#define MULTIBOOT_INFO_MEMORY  (1u << 0)
+#define MULTIBOOT_INFO_CMDLINE (1u << 2)
+#define MULTIBOOT_INFO_MODS    (1u << 3)
+#define MULTIBOOT_INFO_MEM_MAP (1u << 6)
+
+/* Boot information structure GRUB leaves in EBX (Multiboot 0.6.96, section 3.3). */
+typedef struct {
+        uint32_t flags;
+        uint32_t mem_lower;
+        uint32_t mem_upper;
+        uint32_t boot_device;
+        uint32_t cmdline;
+        uint32_t mods_count;
+        uint32_t mods_addr;
+        uint32_t syms[4];
+        uint32_t mmap_length;
+        uint32_t mmap_addr;
+} __attribute__((packed)) multiboot_info_t;
+
+/* One entry of the module list at mods_addr; the module spans [mod_start, mod_end). */
+typedef struct {
+        uint32_t mod_start;
+        uint32_t mod_end;
+        uint32_t string;
+        uint32_t reserved;
+} __attribute__((packed)) multiboot_module_t;
+
+/*
+ * One entry of the BIOS memory map at mmap_addr. size counts the bytes that
+ * follow it, so the next entry starts size + 4 bytes further on.
+ */
+typedef struct {
+        uint32_t size;
+        uint64_t addr;
+        uint64_t len;
+        uint32_t type;
+} __attribute__((packed)) multiboot_mmap_entry_t;
+
+/* mmap entry type for RAM the kernel may use; every other type is reserved. */
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+
+#endif /* ENZOS_MULTIBOOT_H */
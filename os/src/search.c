@@ -0,0 +1,92 @@
+#include <stdbool.h>
+#include <stddef.h>
+#include "cpu.h"
+#include "libk/string.h"
+#include "search.h"
+
+/* Check if the compiler thinks you are targeting the wrong operating system. */
+#if defined(__linux__) && !defined(ALLOW_HOST_TOOLCHAIN)
+#error "You are not using a cross-compiler, you will most certainly run into trouble"
+#endif
+
+/* This tutorial will only work for the 32-bit ix86 targets. */
+#if !defined(__i386__)
+#error "This tutorial needs to be compiled with a ix86-elf compiler"
+#endif
+
+/*
+ * Both kernels filter candidates on the needle's first and last byte before
+ * comparing the bytes in between, which rejects almost every position in
+ * text without touching the middle. The SSE2 kernel tests 16 positions per
+ * step and runs inside a kernel_fpu_begin/kernel_fpu_end section, since the
+ * rest of the kernel is built without SSE.
+ */
+typedef char byte_vector __attribute__((vector_size(16)));
+typedef char unaligned_byte_vector __attribute__((vector_size(16), aligned(1), may_alias));
+
+static long search_scalar(const char* haystack, size_t len, size_t start, const char* needle, size_t needle_len)
+{
+	char first = needle[0];
+	char last = needle[needle_len - 1];
+
+	for (size_t i = start; i + needle_len <= len; ++i) {
+		if (haystack[i] == first && haystack[i + needle_len - 1] == last
+			&& memcmp(haystack + i + 1, needle + 1, needle_len > 2 ? needle_len - 2 : 0) == 0) {
+			return (long)i;
+		}
+	}
+
+	return -1;
+}
+
+__attribute__((target("sse2")))
+static long search_sse2(const char* haystack, size_t len, const char* needle, size_t needle_len)
+{
+	byte_vector first = { 0 };
+	byte_vector last = { 0 };
+	size_t middle = needle_len > 2 ? needle_len - 2 : 0;
+	size_t i = 0;
+
+	first += needle[0];
+	last += needle[needle_len - 1];
+
+	// Each step compares 16 candidate starts: one load for their first
+	// bytes, one for their last bytes.
+	for (; i + needle_len - 1 + 16 <= len; i += 16) {
+		byte_vector starts = *(const unaligned_byte_vector*)(haystack + i);
+		byte_vector ends = *(const unaligned_byte_vector*)(haystack + i + needle_len - 1);
+		unsigned int mask = (unsigned int)__builtin_ia32_pmovmskb128((byte_vector)(starts == first) & (byte_vector)(ends == last));
+
+		while (mask) {
+			size_t candidate = i + (size_t)__builtin_ctz(mask);
+
+			if (memcmp(haystack + candidate + 1, needle + 1, middle) == 0) {
+				return (long)candidate;
+			}
+
+			mask &= mask - 1;
+		}
+	}
+
+	return search_scalar(haystack, len, i, needle, needle_len);
+}
+
+long search_bytes(const char* haystack, size_t len, const char* needle, size_t needle_len)
+{
+	if (needle_len == 0) {
+		return 0;
+	}
+
+	if (!haystack || !needle || needle_len > len) {
+		return -1;
+	}
+
+	if (kernel_fpu_begin()) {
+		long found = search_sse2(haystack, len, needle, needle_len);
+
+		kernel_fpu_end();
+		return found;
+	}
+
+	return search_scalar(haystack, len, 0, needle, needle_len);
+}
@@ -0,0 +1,13 @@
+#ifndef SEARCH_H
+#define SEARCH_H
+
+#include <stddef.h>
+
+/*
+ * Offset of the first occurrence of needle in haystack[0..len), or -1. Both
+ * are plain byte ranges: neither needs a terminator and zero bytes match like
+ * any other. An empty needle matches at offset 0.
+ */
+long search_bytes(const char* haystack, size_t len, const char* needle, size_t needle_len);
+
+#endif
@@ -1,165 +1,19 @@
 #include <stdbool.h>
 #include <stddef.h>
+#include "bcache.h"
+#include "diskfs.h"
+#include "drivers/block.h"
 #include "fs.h"
+#include "libk/string.h"
+#include "mm/kmalloc.h"
+#include "mm/pmm.h"
+#include "search.h"
 #include "shell/commands.h"
 #include "shell/shell.h"
 
-static bool kstreq(const char* a, const char* b)
-{
-        if (!a || !b) {
-                return false;
-        }
-
-	for (size_t i = 0; a[i] != '\0' || b[i] != '\0'; i++) {
-		if (a[i] != b[i]) {
-			return false;
-		}
-	}
-
-        return true;
-}
-
-static size_t kstrlen(const char* str)
-{
-        size_t len = 0;
-
-        if (!str) {
-                return 0;
-        }
-
-        while (str[len] != '\0') {
-                ++len;
-        }
-
-        return len;
-}
-
-static void kstrncpy(char* dest, const char* src, size_t max_len)
-{
-        size_t i;
-
-        if (!dest || !src || max_len == 0) {
-                return;
-        }
-
-        for (i = 0; i + 1 < max_len && src[i] != '\0'; ++i) {
-                dest[i] = src[i];
-        }
-
-        dest[i] = '\0';
-}
-
 static FSNode* resolve_parent_dir(const char* path, char* name, size_t name_size)
 {
-        char parent_path[128];
-        size_t len;
-        int last_sep = -1;
-
-        if (!path || !name) {
-                return NULL;
-        }
-
-        len = kstrlen(path);
-
-        while (len > 1 && path[len - 1] == '/') {
-                --len;
-        }
-
-        for (size_t i = 0; i < len; ++i) {
-                if (path[i] == '/') {
-                        last_sep = (int)i;
-                }
-        }
-
-        if (last_sep == -1) {
-                kstrncpy(name, path, name_size);
-                return fs_get_cwd();
-        }
-
-        if ((size_t)last_sep >= len - 1) {
-                return NULL;
-        }
-
-        if (last_sep == 0) {
-                        parent_path[0] = '/';
-                        parent_path[1] = '\0';
-        } else {
-                        size_t copy_len = (size_t)last_sep;
-
-                        if (copy_len >= sizeof(parent_path)) {
-                                copy_len = sizeof(parent_path) - 1;
-                        }
-
-                        for (size_t i = 0; i < copy_len; ++i) {
-                                parent_path[i] = path[i];
-                        }
-                        parent_path[copy_len] = '\0';
-        }
-
-        kstrncpy(name, path + last_sep + 1, name_size);
-
-        {
-                FSNode* parent = fs_resolve_path(fs_get_cwd(), parent_path);
-
-                if (parent && fs_is_dir(parent)) {
-                        return parent;
-                }
-        }
-
-        return NULL;
-}
-
-static int unlink_child(FSNode* node)
-{
-        FSNode* parent;
-        int index = -1;
-
-        if (!node || !node->parent) {
-                return -1;
-        }
-
-        parent = node->parent;
-
-        for (int i = 0; i < parent->child_count; ++i) {
-                if (parent->children[i] == node) {
-                        index = i;
-                        break;
-                }
-        }
-
-        if (index == -1) {
-                return -1;
-        }
-
-        for (int i = index; i < parent->child_count - 1; ++i) {
-                parent->children[i] = parent->children[i + 1];
-        }
-
-        parent->children[parent->child_count - 1] = NULL;
-        parent->child_count--;
-        node->parent = NULL;
-
-        return 0;
-}
-
-static int link_child(FSNode* parent, FSNode* node)
-{
-        if (!parent || !node || !fs_is_dir(parent)) {
-                return -1;
-        }
-
-        if (fs_lookup(parent, node->name)) {
-                return -1;
-        }
-
-        if (parent->child_count >= 32) {
-                return -1;
-        }
-
-        parent->children[parent->child_count++] = node;
-        node->parent = parent;
-
-        return 0;
+        return fs_resolve_parent(fs_get_cwd(), path, name, name_size);
 }
 
 static bool is_ancestor(FSNode* ancestor, FSNode* node)
@@ -174,43 +28,6 @@ static bool is_ancestor(FSNode* ancestor, FSNode* node)
         return false;
 }
 
-static int move_node(FSNode* node, FSNode* target_parent, const char* new_name)
-{
-        FSNode* existing;
-
-        if (!node || !target_parent || !new_name || !fs_is_dir(target_parent)) {
-                return -1;
-        }
-
-        if (!node->parent) {
-                return -1;
-        }
-
-        if (is_ancestor(node, target_parent)) {
-                return -1;
-        }
-
-        existing = fs_lookup(target_parent, new_name);
-
-        if (existing && existing != node) {
-                if (fs_is_dir(existing) || !fs_is_file(node)) {
-                        return -1;
-                }
-
-                if (fs_remove(existing) != 0) {
-                        return -1;
-                }
-        }
-
-        if (unlink_child(node) != 0) {
-                return -1;
-        }
-
-        kstrncpy(node->name, new_name, sizeof(node->name));
-
-        return link_child(target_parent, node);
-}
-
 static size_t arg_count(const char* const* args)
 {
 	size_t count = 0;
@@ -270,9 +87,8 @@ static int command_ls(const char* const* args, size_t argc)
                 target = resolved;
         }
 
-        for (int i = 0; i < target->child_count; i++) {
-                FSNode* child = target->children[i];
-                shell_output_string(child->name);
+        for (FSNode* child = fs_first_child(target); child; child = child->next_sibling) {
+                shell_output_string(fs_name(child));
                 if (child->type == NODE_DIR) {
                         shell_output_char('/');
                 }
@@ -344,7 +160,9 @@ static int command_cat(const char* path)
 {
         FSNode* cwd = fs_get_cwd();
         FSNode* file;
-        const char* data;
+        char chunk[64];
+        size_t remaining;
+        int fd;
 
 	if (!path) {
 		shell_output_string("cat: missing filename\n");
@@ -359,12 +177,35 @@ static int command_cat(const char* path)
 		return -1;
 	}
 
-	data = fs_read(file);
-	if (data) {
-		shell_output_string(data);
+        if (fs_size(file) == 0) {
+                return 0;
+        }
+
+        fd = fs_open(file, FS_OPEN_READ);
+        if (fd < 0) {
+                shell_output_string("cat: cannot open: ");
+                shell_output_string(path);
                 shell_output_char('\n');
+                return -1;
+        }
+
+        // Stop at the size seen when opening so `cat f >> f` terminates.
+        remaining = fs_size(file);
+
+        while (remaining > 0) {
+                int read = fs_read_fd(fd, chunk, remaining < sizeof(chunk) ? remaining : sizeof(chunk));
+
+                if (read <= 0) {
+                        break;
+                }
+
+                shell_output_bytes(chunk, (size_t)read);
+                remaining -= (size_t)read;
         }
 
+        fs_close(fd);
+        shell_output_char('\n');
+
         return 0;
 }
 
@@ -401,11 +242,11 @@ static int mkdir_create_parents(const char* path)
 
                 segment[seg_len] = '\0';
 
-                if (seg_len == 0 || kstreq(segment, ".")) {
+                if (seg_len == 0 || strcmp(segment, ".") == 0) {
                         continue;
                 }
 
-                if (kstreq(segment, "..")) {
+                if (strcmp(segment, "..") == 0) {
                         if (node && node->parent) {
                                 node = node->parent;
                         }
@@ -634,7 +475,7 @@ static int command_cp(const char* const* args, size_t count)
                         }
 
                         if (dest_is_dir) {
-                                kstrncpy(target_name, source_node->name, sizeof(target_name));
+                                strlcpy(target_name, fs_name(source_node), sizeof(target_name));
                                 target_parent = dest_node;
                         } else {
                                 target_parent = resolve_parent_dir(dest_path, target_name, sizeof(target_name));
@@ -703,7 +544,7 @@ static int command_mv(const char* const* args, size_t count)
                         }
 
                         if (dest_is_dir) {
-                                kstrncpy(target_name, source_node->name, sizeof(target_name));
+                                strlcpy(target_name, fs_name(source_node), sizeof(target_name));
                                 target_parent = dest_node;
                         } else {
                                 target_parent = resolve_parent_dir(dest_path, target_name, sizeof(target_name));
@@ -716,12 +557,13 @@ static int command_mv(const char* const* args, size_t count)
                                 continue;
                         }
 
-                        if (is_ancestor(source_node, target_parent)) {
-                                shell_output_string("mv: cannot move a directory into itself\n");
-                                continue;
-                        }
+                        // fs_move replaces an existing file itself, after all of its checks.
+                        if (fs_move(source_node, target_parent, target_name, 1) != 0) {
+                                if (is_ancestor(source_node, target_parent)) {
+                                        shell_output_string("mv: cannot move a directory into itself\n");
+                                        continue;
+                                }
 
-                        if (move_node(source_node, target_parent, target_name) != 0) {
                                 shell_output_string("mv: cannot move '");
                                 shell_output_string(source_path);
                                 shell_output_string("'\n");
@@ -732,14 +574,212 @@ static int command_mv(const char* const* args, size_t count)
         return 0;
 }
 
-static void shell_print_tree_node(FSNode* node, int depth)
+static int command_lsblk(void)
+{
+        BcacheStats cache;
+
+        for (size_t i = 0; i < block_device_count(); ++i) {
+                const BlockDevice* device = block_device_at(i);
+
+                shell_output_string(device->name);
+                shell_output_string(": ");
+                shell_output_number((int)device->sector_count);
+                shell_output_string(" sectors (");
+                shell_output_number((int)(device->sector_count / 2048));
+                shell_output_string(" MiB), ");
+                shell_output_string(device->mode);
+                shell_output_char('\n');
+                shell_output_string("  requests ");
+                shell_output_number((int)device->stats.requests);
+                shell_output_string(", merged ");
+                shell_output_number((int)device->stats.merged);
+                shell_output_string(", commands ");
+                shell_output_number((int)device->stats.commands);
+                shell_output_string(", errors ");
+                shell_output_number((int)device->stats.errors);
+                shell_output_char('\n');
+        }
+
+        bcache_get_stats(&cache);
+        shell_output_string("cache: hits ");
+        shell_output_number((int)cache.hits);
+        shell_output_string(", misses ");
+        shell_output_number((int)cache.misses);
+        shell_output_string(", read-ahead ");
+        shell_output_number((int)cache.readaheads);
+        shell_output_string(", write-backs ");
+        shell_output_number((int)cache.writebacks);
+        shell_output_char('\n');
+        return 0;
+}
+
+// Print used/max, e.g. "12/192".
+static void output_usage(size_t used, size_t max)
+{
+        shell_output_number((int)used);
+        shell_output_char('/');
+        shell_output_number((int)max);
+}
+
+// Print numerator/denominator with one decimal, e.g. "2.5".
+static void output_average(unsigned int numerator, unsigned int denominator)
+{
+        unsigned int tenths = denominator ? (numerator * 10 + denominator / 2) / denominator : 0;
+
+        shell_output_number((int)(tenths / 10));
+        shell_output_char('.');
+        shell_output_number((int)(tenths % 10));
+}
+
+static int command_fsstat(void)
+{
+        FSStats stats;
+
+        fs_get_stats(&stats);
+
+        shell_output_string("nodes: ");
+        output_usage(stats.nodes_used, stats.nodes_capacity);
+        shell_output_string(" (peak ");
+        shell_output_number((int)stats.nodes_peak);
+        shell_output_string("), dirs ");
+        shell_output_number((int)stats.dirs_used);
+        shell_output_string(" (peak ");
+        shell_output_number((int)stats.dirs_peak);
+        shell_output_string("), long names ");
+        shell_output_number((int)stats.long_names_used);
+        shell_output_char('\n');
+
+        shell_output_string("content: ");
+        shell_output_number((int)stats.content_live);
+        shell_output_string(" live, ");
+        shell_output_number((int)stats.content_dead);
+        shell_output_string(" dead, ");
+        output_usage(stats.content_carved, stats.content_max);
+        shell_output_string(" carved (peak ");
+        shell_output_number((int)stats.content_peak);
+        shell_output_string("), compactions ");
+        shell_output_number((int)stats.compactions);
+        shell_output_char('\n');
+
+        shell_output_string("ops: lookup ");
+        shell_output_number((int)stats.lookups);
+        shell_output_string(", resolve ");
+        shell_output_number((int)stats.resolves);
+        shell_output_string(", write ");
+        shell_output_number((int)stats.writes);
+        shell_output_string(", append ");
+        shell_output_number((int)stats.appends);
+        shell_output_string(", create ");
+        shell_output_number((int)stats.creates);
+        shell_output_string(", remove ");
+        shell_output_number((int)stats.removes);
+        shell_output_char('\n');
+
+        shell_output_string("paths: depth ");
+        output_average(stats.path_segments, stats.resolves);
+        shell_output_string(", walked ");
+        output_average(stats.segments_walked, stats.resolves);
+        shell_output_string(" segments per resolve, ");
+        shell_output_number((int)stats.resolve_hits);
+        shell_output_string(" cache hits\n");
+        return 0;
+}
+
+static int command_free(void)
+{
+        KmallocStats heap;
+
+        shell_output_string("memory: ");
+        shell_output_number((int)(pmm_total_frames() * (PMM_FRAME_SIZE / 1024)));
+        shell_output_string(" KiB usable, ");
+        shell_output_number((int)(pmm_free_frames() * (PMM_FRAME_SIZE / 1024)));
+        shell_output_string(" KiB free\n");
+
+        // One column per block size, from a single frame up to 4 MiB.
+        shell_output_string("free blocks:");
+
+        for (unsigned int order = 0; order <= PMM_MAX_ORDER; ++order) {
+                shell_output_char(' ');
+                shell_output_number((int)pmm_free_blocks(order));
+        }
+
+        shell_output_char('\n');
+
+        kmalloc_get_stats(&heap);
+        shell_output_string("heap: ");
+        shell_output_number((int)heap.allocations);
+        shell_output_string(" allocs, ");
+        shell_output_number((int)heap.frees);
+        shell_output_string(" frees, ");
+        shell_output_number((int)heap.failures);
+        shell_output_string(" failed, ");
+        shell_output_number((int)heap.large_blocks);
+        shell_output_string(" large blocks in ");
+        shell_output_number((int)heap.large_frames);
+        shell_output_string(" frames\n");
+
+        // Only caches that own a slab, e.g. "slab 64: 12/63 in 1 frames".
+        for (size_t i = 0; i < KMALLOC_CLASSES; ++i) {
+                const KmallocCacheStats* cache = &heap.caches[i];
+
+                if (cache->slabs == 0) {
+                        continue;
+                }
+
+                shell_output_string("slab ");
+                shell_output_number((int)cache->object_size);
+                shell_output_string(": ");
+                output_usage(cache->objects, cache->capacity);
+                shell_output_string(" in ");
+                shell_output_number((int)cache->slabs);
+                shell_output_string(" frames\n");
+        }
+
+        return 0;
+}
+
+static int command_sync(void)
+{
+        if (diskfs_sync() != 0 || bcache_sync() != 0) {
+                shell_output_string("sync: I/O error\n");
+                return -1;
+        }
+
+        return 0;
+}
+
+static int command_mkfs(const char* name)
+{
+        BlockDevice* device = name ? block_device_find(name) : block_device_at(0);
+
+        if (!device) {
+                shell_output_string("mkfs: no such disk\n");
+                return -1;
+        }
+
+        if (diskfs_mkfs(device) != 0) {
+                shell_output_string("mkfs: failed to format ");
+                shell_output_string(device->name);
+                shell_output_char('\n');
+                return -1;
+        }
+
+        shell_output_string("Formatted ");
+        shell_output_string(device->name);
+        shell_output_string(" and saved the current tree.\n");
+        return 0;
+}
+
+static int shell_print_tree_node(FSNode* node, int depth, void* ctx)
 {
+	(void)ctx;
+
 	for (int i = 0; i < depth; i++) {
 		shell_output_string("  ");
 	}
 
 	if (node->parent) {
-		shell_output_string(node->name);
+		shell_output_string(fs_name(node));
 		if (fs_is_dir(node)) {
 			shell_output_char('/');
 		}
@@ -748,14 +788,559 @@ static void shell_print_tree_node(FSNode* node, int depth)
 	}
 
 	shell_output_char('\n');
+	return FS_WALK_CONTINUE;
+}
+
+static int shell_print_found(FSNode* node, int depth, void* ctx)
+{
+	(void)depth;
+	(void)ctx;
+
+	shell_print_path(node);
+	shell_output_char('\n');
+	return FS_WALK_CONTINUE;
+}
+
+static int command_find(size_t argc, const char* const* args)
+{
+	FSNode* start = fs_get_cwd();
+	const char* pattern = NULL;
+	size_t i = 0;
+
+	if (argc > 0 && args[0][0] != '-') {
+		start = fs_resolve_path(start, args[0]);
+		if (!start) {
+			shell_output_string("find: '");
+			shell_output_string(args[0]);
+			shell_output_string("': No such file or directory\n");
+			return -1;
+		}
+		i = 1;
+	}
+
+	for (; i < argc; ++i) {
+		if (strcmp(args[i], "-name") != 0) {
+			shell_output_string("find: unknown predicate '");
+			shell_output_string(args[i]);
+			shell_output_string("'\n");
+			return -1;
+		}
+
+		if (i + 1 >= argc) {
+			shell_output_string("find: missing argument to '-name'\n");
+			return -1;
+		}
+
+		pattern = args[++i];
+	}
+
+	if (!pattern) {
+		fs_walk(start, shell_print_found, NULL, NULL);
+		return 0;
+	}
+
+	fs_find(start, pattern, shell_print_found, NULL);
+	return 0;
+}
+
+/*
+ * Print bytes [offset, offset + len) of a file. When output is redirected,
+ * writing the target file can compact the content pool and move this file's
+ * bytes, so they are copied out a small chunk at a time instead of printed
+ * through a pointer held across the writes.
+ */
+static void output_file_range(FSNode* file, size_t offset, size_t len)
+{
+	char chunk[64];
+
+	while (len > 0) {
+		int read = fs_read_range(file, offset, chunk, len < sizeof(chunk) ? len : sizeof(chunk));
+
+		if (read <= 0) {
+			return;
+		}
+
+		shell_output_bytes(chunk, (size_t)read);
+		offset += (size_t)read;
+		len -= (size_t)read;
+	}
+}
+
+// Length of the line at offset, excluding its newline.
+static size_t line_length(const char* data, size_t size, size_t offset)
+{
+	const char* end = memchr(data + offset, '\n', size - offset);
+
+	return end ? (size_t)(end - (data + offset)) : size - offset;
+}
+
+static FSNode* open_text_file(const char* command, const char* path)
+{
+	FSNode* file = path ? fs_resolve_path(fs_get_cwd(), path) : NULL;
+
+	if (!path) {
+		shell_output_string(command);
+		shell_output_string(": missing filename\n");
+	} else if (!fs_is_file(file)) {
+		shell_output_string(command);
+		shell_output_string(": no such file: ");
+		shell_output_string(path);
+		shell_output_char('\n');
+		file = NULL;
+	}
+
+	return file;
+}
+
+static bool parse_count(const char* text, size_t* count)
+{
+	size_t value = 0;
+
+	if (!text || text[0] == '\0') {
+		return false;
+	}
+
+	for (size_t i = 0; text[i] != '\0'; ++i) {
+		if (text[i] < '0' || text[i] > '9') {
+			return false;
+		}
+		value = value * 10 + (size_t)(text[i] - '0');
+	}
+
+	*count = value;
+	return true;
+}
+
+static int command_wc(const char* const* args, size_t count)
+{
+	size_t totals[3] = { 0, 0, 0 };
+
+	if (count == 0) {
+		shell_output_string("wc: missing filename\n");
+		return -1;
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		FSNode* file = open_text_file("wc", args[i]);
+		const char* data;
+		size_t size;
+		size_t counts[3] = { 0, 0, 0 }; // lines, words, bytes
+		bool in_word = false;
+
+		if (!file) {
+			continue;
+		}
+
+		data = fs_read(file);
+		size = fs_size(file);
+
+		for (size_t j = 0; j < size; ++j) {
+			bool space = data[j] == ' ' || data[j] == '\n' || data[j] == '\t' || data[j] == '\r';
+
+			if (data[j] == '\n') {
+				++counts[0];
+			}
+
+			if (!space && !in_word) {
+				++counts[1];
+			}
+
+			in_word = !space;
+		}
+
+		counts[2] = size;
+
+		for (size_t k = 0; k < 3; ++k) {
+			shell_output_number((int)counts[k]);
+			shell_output_char(' ');
+			totals[k] += counts[k];
+		}
+
+		shell_output_string(args[i]);
+		shell_output_char('\n');
+	}
+
+	if (count > 1) {
+		for (size_t k = 0; k < 3; ++k) {
+			shell_output_number((int)totals[k]);
+			shell_output_char(' ');
+		}
+
+		shell_output_string("total\n");
+	}
+
+	return 0;
+}
+
+/*
+ * head and tail take "-n N" (default 10) before the file name. Both only
+ * locate the cut with a scan; tail walks backward from the end so it never
+ * reads the part of the file it skips.
+ */
+static int command_head_tail(const char* command, const char* const* args, size_t count, bool tail)
+{
+	size_t lines = 10;
+	size_t path_index = 0;
+	FSNode* file;
+	const char* data;
+	size_t size;
+	size_t start = 0;
+	size_t end;
+	bool unterminated;
+
+	if (count > 0 && strcmp(args[0], "-n") == 0) {
+		if (count < 2 || !parse_count(args[1], &lines)) {
+			shell_output_string(command);
+			shell_output_string(": invalid number of lines\n");
+			return -1;
+		}
+		path_index = 2;
+	}
+
+	file = open_text_file(command, path_index < count ? args[path_index] : NULL);
+	if (!file) {
+		return -1;
+	}
+
+	data = fs_read(file);
+	size = fs_size(file);
+	end = size;
+
+	if (tail) {
+		size_t seen = 0;
+
+		// A trailing newline ends the last line rather than starting another.
+		start = size > 0 && data[size - 1] == '\n' ? size - 1 : size;
+
+		while (start > 0 && (data[start - 1] != '\n' || ++seen < lines)) {
+			--start;
+		}
+
+		if (lines == 0) {
+			start = size;
+		}
+	} else {
+		size_t seen = 0;
+
+		end = 0;
+		while (end < size && seen < lines) {
+			if (data[end++] == '\n') {
+				++seen;
+			}
+		}
+	}
+
+	unterminated = end > start && data[end - 1] != '\n';
+	output_file_range(file, start, end - start);
+
+	if (unterminated) {
+		shell_output_char('\n');
+	}
+
+	return 0;
+}
+
+/*
+ * sort keeps only line offsets, in a heap array sized to the file's line
+ * count, and compares the lines where they lie in the file, so sorting
+ * never copies line text.
+ */
+static int compare_lines(const char* data, size_t size, size_t a, size_t b)
+{
+	while (a < size && b < size && data[a] != '\n' && data[a] == data[b]) {
+		++a;
+		++b;
+	}
+
+	return (int)(a < size && data[a] != '\n' ? (unsigned char)data[a] : 0)
+		- (int)(b < size && data[b] != '\n' ? (unsigned char)data[b] : 0);
+}
+
+static void sift_down(const char* data, size_t size, size_t* offsets, size_t root, size_t count)
+{
+	for (;;) {
+		size_t child = root * 2 + 1;
+		size_t swap;
+
+		if (child >= count) {
+			return;
+		}
+
+		if (child + 1 < count && compare_lines(data, size, offsets[child], offsets[child + 1]) < 0) {
+			++child;
+		}
+
+		if (compare_lines(data, size, offsets[root], offsets[child]) >= 0) {
+			return;
+		}
+
+		swap = offsets[root];
+		offsets[root] = offsets[child];
+		offsets[child] = swap;
+		root = child;
+	}
+}
+
+static int command_sort(const char* path)
+{
+	FSNode* file = open_text_file("sort", path);
+	const char* data;
+	size_t* offsets;
+	size_t size;
+	size_t count = 0;
+
+	if (!file) {
+		return -1;
+	}
+
+	data = fs_read(file);
+	size = fs_size(file);
+
+	for (size_t offset = 0; offset < size; offset += line_length(data, size, offset) + 1) {
+		++count;
+	}
+
+	if (count == 0) {
+		return 0;
+	}
+
+	offsets = kmalloc(count * sizeof(*offsets));
+
+	if (!offsets) {
+		shell_output_string("sort: out of memory\n");
+		return -1;
+	}
+
+	count = 0;
+	for (size_t offset = 0; offset < size; offset += line_length(data, size, offset) + 1) {
+		offsets[count++] = offset;
+	}
+
+	// Heapsort: in place and without recursion.
+	for (size_t i = count / 2; i > 0; --i) {
+		sift_down(data, size, offsets, i - 1, count);
+	}
+
+	for (size_t end = count; end > 1; --end) {
+		size_t swap = offsets[0];
+
+		offsets[0] = offsets[end - 1];
+		offsets[end - 1] = swap;
+		sift_down(data, size, offsets, 0, end - 1);
+	}
+
+	for (size_t i = 0; i < count; ++i) {
+		output_file_range(file, offsets[i], line_length(fs_read(file), size, offsets[i]));
+		shell_output_char('\n');
+	}
+
+	kfree(offsets);
+	return 0;
+}
+
+static void output_uniq_line(FSNode* file, size_t offset, size_t len, int repeats, bool show_counts)
+{
+	if (show_counts) {
+		shell_output_number(repeats);
+		shell_output_char(' ');
+	}
+
+	output_file_range(file, offset, len);
+	shell_output_char('\n');
+}
+
+static int command_uniq(const char* const* args, size_t count)
+{
+	bool show_counts = count > 0 && strcmp(args[0], "-c") == 0;
+	FSNode* file = open_text_file("uniq", show_counts ? (count > 1 ? args[1] : NULL) : (count > 0 ? args[0] : NULL));
+	size_t size;
+	size_t previous = 0;
+	size_t previous_len = 0;
+	int repeats = 0;
+
+	if (!file) {
+		return -1;
+	}
+
+	size = fs_size(file);
+
+	for (size_t offset = 0; offset < size;) {
+		const char* data = fs_read(file);
+		size_t len = line_length(data, size, offset);
+
+		if (repeats > 0 && len == previous_len && compare_lines(data, size, previous, offset) == 0) {
+			++repeats;
+		} else {
+			if (repeats > 0) {
+				output_uniq_line(file, previous, previous_len, repeats, show_counts);
+			}
+			previous = offset;
+			previous_len = len;
+			repeats = 1;
+		}
+
+		offset += len + 1;
+	}
+
+	if (repeats > 0) {
+		output_uniq_line(file, previous, previous_len, repeats, show_counts);
+	}
+
+	return 0;
+}
+
+typedef struct {
+	const char* pattern;
+	size_t pattern_len;
+	bool count_only;
+	bool names_only;
+	bool show_names;
+} GrepOptions;
+
+/*
+ * Search one file in place: the content pointer is walked directly, so no
+ * bytes are copied, and each hit skips to the end of its line so a line is
+ * reported once however many times it matches. Printing can move the
+ * contents (see output_file_range), so the pointer is fetched again after.
+ */
+static void grep_file(FSNode* file, const GrepOptions* options)
+{
+	const char* data;
+	size_t size = fs_size(file);
+	size_t pos = 0;
+	int matches = 0;
+
+	while (pos < size) {
+		long found;
+
+		data = fs_read(file);
+		found = search_bytes(data + pos, size - pos, options->pattern, options->pattern_len);
+		size_t start;
+		size_t end;
+
+		if (found < 0) {
+			break;
+		}
+
+		start = pos + (size_t)found;
+		end = start + options->pattern_len;
+
+		while (start > pos && data[start - 1] != '\n') {
+			--start;
+		}
+
+		while (end < size && data[end] != '\n') {
+			++end;
+		}
+
+		++matches;
+
+		if (options->names_only) {
+			break;
+		}
+
+		if (!options->count_only) {
+			if (options->show_names) {
+				shell_print_path(file);
+				shell_output_char(':');
+			}
+			output_file_range(file, start, end - start);
+			shell_output_char('\n');
+		}
+
+		pos = end + 1;
+	}
+
+	if (options->names_only && matches > 0) {
+		shell_print_path(file);
+		shell_output_char('\n');
+	} else if (options->count_only) {
+		if (options->show_names) {
+			shell_print_path(file);
+			shell_output_char(':');
+		}
+		shell_output_number(matches);
+		shell_output_char('\n');
+	}
+}
+
+static int grep_walked(FSNode* node, int depth, void* ctx)
+{
+	(void)depth;
+
+	if (fs_is_file(node)) {
+		grep_file(node, ctx);
+	}
+
+	return FS_WALK_CONTINUE;
+}
+
+static int command_grep(const char* const* args, size_t count)
+{
+	GrepOptions options = { 0 };
+	bool recursive = false;
+	size_t i = 0;
+
+	for (; i < count && args[i][0] == '-' && args[i][1] != '\0'; ++i) {
+		// "--" ends the options, so a pattern may itself start with '-'.
+		if (strcmp(args[i], "--") == 0) {
+			++i;
+			break;
+		}
+
+		if (args[i][1] == '-') {
+			shell_output_string("grep: unrecognized option '");
+			shell_output_string(args[i]);
+			shell_output_string("'\n");
+			return -1;
+		}
+
+		for (size_t j = 1; args[i][j] != '\0'; ++j) {
+			if (args[i][j] == 'r') {
+				recursive = true;
+			} else if (args[i][j] == 'c') {
+				options.count_only = true;
+			} else if (args[i][j] == 'l') {
+				options.names_only = true;
+			} else {
+				shell_output_string("grep: invalid option '");
+				shell_output_char(args[i][j]);
+				shell_output_string("'\n");
+				return -1;
+			}
+		}
+	}
 
-	if (!fs_is_dir(node)) {
-		return;
+	if (i + 1 >= count) {
+		shell_output_string("usage: grep [-r] [-c] [-l] [--] pattern path...\n");
+		return -1;
 	}
 
-	for (int i = 0; i < node->child_count; i++) {
-		shell_print_tree_node(node->children[i], depth + 1);
+	options.pattern = args[i++];
+	options.pattern_len = strlen(options.pattern);
+	options.show_names = recursive || count - i > 1;
+
+	for (; i < count; ++i) {
+		FSNode* target = fs_resolve_path(fs_get_cwd(), args[i]);
+
+		if (!target) {
+			shell_output_string("grep: ");
+			shell_output_string(args[i]);
+			shell_output_string(": No such file or directory\n");
+			continue;
+		}
+
+		if (fs_is_dir(target) && !recursive) {
+			shell_output_string("grep: ");
+			shell_output_string(args[i]);
+			shell_output_string(": Is a directory\n");
+			continue;
+		}
+
+		fs_walk(target, grep_walked, NULL, &options);
 	}
+
+	return 0;
 }
 
 int commands_execute(const char* command, const char* const* args)
@@ -768,51 +1353,99 @@ int commands_execute(const char* command, const char* const* args)
 
 	argc = arg_count(args);
 
-	if (kstreq(command, "echo")) {
+	if (strcmp(command, "echo") == 0) {
 		return command_echo(args);
 	}
 
-	if (kstreq(command, "pwd")) {
+	if (strcmp(command, "pwd") == 0) {
 		return command_pwd();
 	}
 
-        if (kstreq(command, "ls")) {
+        if (strcmp(command, "ls") == 0) {
                 return command_ls(args, argc);
         }
 
-	if (kstreq(command, "cd")) {
+	if (strcmp(command, "cd") == 0) {
 		return command_cd(argc > 0 ? args[0] : NULL);
 	}
 
-        if (kstreq(command, "touch")) {
+        if (strcmp(command, "touch") == 0) {
                 return command_touch(argc > 0 ? args[0] : NULL);
         }
 
-	if (kstreq(command, "cat")) {
+	if (strcmp(command, "cat") == 0) {
 		return command_cat(argc > 0 ? args[0] : NULL);
 	}
 
-        if (kstreq(command, "mkdir")) {
+        if (strcmp(command, "mkdir") == 0) {
                 return command_mkdir(args, argc);
         }
 
-	if (kstreq(command, "rmdir")) {
+	if (strcmp(command, "rmdir") == 0) {
 		return command_rmdir(args, argc);
 	}
 
-        if (kstreq(command, "rm")) {
+        if (strcmp(command, "rm") == 0) {
                 return command_rm(args, argc);
         }
 
-        if (kstreq(command, "cp")) {
+        if (strcmp(command, "cp") == 0) {
                 return command_cp(args, argc);
         }
 
-        if (kstreq(command, "mv")) {
+        if (strcmp(command, "mv") == 0) {
                 return command_mv(args, argc);
         }
 
-	if (kstreq(command, "tree")) {
+        if (strcmp(command, "lsblk") == 0) {
+                return command_lsblk();
+        }
+
+        if (strcmp(command, "fsstat") == 0) {
+                return command_fsstat();
+        }
+
+        if (strcmp(command, "free") == 0) {
+                return command_free();
+        }
+
+        if (strcmp(command, "sync") == 0) {
+                return command_sync();
+        }
+
+        if (strcmp(command, "mkfs") == 0) {
+                return command_mkfs(argc > 0 ? args[0] : NULL);
+        }
+
+        if (strcmp(command, "wc") == 0) {
+                return command_wc(args, argc);
+        }
+
+        if (strcmp(command, "head") == 0) {
+                return command_head_tail("head", args, argc, false);
+        }
+
+        if (strcmp(command, "tail") == 0) {
+                return command_head_tail("tail", args, argc, true);
+        }
+
+        if (strcmp(command, "sort") == 0) {
+                return command_sort(argc > 0 ? args[0] : NULL);
+        }
+
+        if (strcmp(command, "uniq") == 0) {
+                return command_uniq(args, argc);
+        }
+
+        if (strcmp(command, "grep") == 0) {
+                return command_grep(args, argc);
+        }
+
+        if (strcmp(command, "find") == 0) {
+                return command_find(argc, args);
+        }
+
+	if (strcmp(command, "tree") == 0) {
 		FSNode* start = fs_get_cwd();
 
 		if (argc > 0) {
@@ -828,7 +1461,7 @@ int commands_execute(const char* command, const char* const* args)
 			start = resolved;
 		}
 
-		shell_print_tree_node(start, 0);
+		fs_walk(start, shell_print_tree_node, NULL, NULL);
 		return 0;
 	}
 
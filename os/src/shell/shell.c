@@ -3,73 +3,48 @@
 #include "drivers/keyboard.h"
 #include "drivers/terminal.h"
 #include "fs.h"
+#include "libk/string.h"
+#include "mm/kmalloc.h"
 #include "shell/commands.h"
 #include "shell/shell.h"
 
-static char* capture_buffer = NULL;
-static size_t capture_capacity = 0;
+static char capture_chunk[64];
 static size_t capture_length = 0;
+static int capture_fd = -1;
+static bool capture_failed = false;
 static bool capture_active = false;
-static char history_entries[32][128];
+#define SHELL_HISTORY_SIZE 32
+
+/*
+ * History and aliases live on the kernel heap, each string allocated at its
+ * own length. History is a ring of the last SHELL_HISTORY_SIZE lines starting
+ * at history_first; aliases are a list kept in definition order.
+ */
+static char* history_entries[SHELL_HISTORY_SIZE];
+static int history_first = 0;
 static int history_count = 0;
 
-typedef struct {
-        char name[32];
-        char expansion[128];
+typedef struct ShellAlias {
+        struct ShellAlias* next;
+        char* name;
+        char* expansion;
 } ShellAlias;
 
-static ShellAlias alias_table[16];
-static int alias_count = 0;
+static ShellAlias* alias_list = NULL;
 
-static size_t shell_strlen(const char* str)
+static char* shell_strdup(const char* str)
 {
-        size_t len = 0;
+        size_t len = strlen(str);
+        char* copy = kmalloc(len + 1);
 
-        if (!str) {
-                return 0;
-        }
-
-        while (str[len] != '\0') {
-                ++len;
-        }
-
-        return len;
-}
-
-static void shell_strncpy(char* dest, const char* src, size_t max_len)
-{
-        size_t i;
-
-        if (!dest || !src || max_len == 0) {
-                return;
-        }
-
-        for (i = 0; i + 1 < max_len && src[i] != '\0'; ++i) {
-                dest[i] = src[i];
-        }
-
-        dest[i] = '\0';
-}
-
-static bool shell_streq(const char* a, const char* b)
-{
-        size_t i = 0;
-
-        if (!a || !b) {
-                return false;
+        if (copy) {
+                memcpy(copy, str, len + 1);
         }
 
-        while (a[i] != '\0' || b[i] != '\0') {
-                if (a[i] != b[i]) {
-                        return false;
-                }
-                ++i;
-        }
-
-        return true;
+        return copy;
 }
 
-static void shell_output_number(int number)
+void shell_output_number(int number)
 {
         char buffer[12];
         int index = 0;
@@ -97,20 +72,27 @@ static void shell_output_number(int number)
 
 static void shell_history_record(const char* line)
 {
+        char* copy;
+
         if (!line) {
                 return;
         }
 
-        if (history_count < 32) {
-                shell_strncpy(history_entries[history_count++], line, sizeof(history_entries[0]));
+        copy = shell_strdup(line);
+
+        if (!copy) {
                 return;
         }
 
-        for (int i = 1; i < 32; ++i) {
-                shell_strncpy(history_entries[i - 1], history_entries[i], sizeof(history_entries[0]));
+        if (history_count < SHELL_HISTORY_SIZE) {
+                history_entries[(history_first + history_count++) % SHELL_HISTORY_SIZE] = copy;
+                return;
         }
 
-        shell_strncpy(history_entries[31], line, sizeof(history_entries[0]));
+        // Full: the new line takes the oldest line's slot.
+        kfree(history_entries[history_first]);
+        history_entries[history_first] = copy;
+        history_first = (history_first + 1) % SHELL_HISTORY_SIZE;
 }
 
 static void shell_print_history(void)
@@ -118,73 +100,113 @@ static void shell_print_history(void)
         for (int i = 0; i < history_count; ++i) {
                 shell_output_number(i + 1);
                 shell_output_char(' ');
-                shell_output_string(history_entries[i]);
+                shell_output_string(history_entries[(history_first + i) % SHELL_HISTORY_SIZE]);
                 shell_output_char('\n');
         }
 }
 
+static ShellAlias* shell_alias_find(const char* name)
+{
+        for (ShellAlias* alias = alias_list; alias; alias = alias->next) {
+                if (strcmp(alias->name, name) == 0) {
+                        return alias;
+                }
+        }
+
+        return NULL;
+}
+
 static int shell_alias_set(const char* name, const char* expansion)
 {
+        ShellAlias* alias;
+        ShellAlias** link;
+        char* copy;
+
         if (!name || !expansion) {
                 return -1;
         }
 
-        for (int i = 0; i < alias_count; ++i) {
-                if (shell_streq(alias_table[i].name, name)) {
-                        shell_strncpy(alias_table[i].expansion, expansion, sizeof(alias_table[i].expansion));
-                        return 0;
-                }
+        copy = shell_strdup(expansion);
+
+        if (!copy) {
+                return -1;
+        }
+
+        alias = shell_alias_find(name);
+
+        if (alias) {
+                kfree(alias->expansion);
+                alias->expansion = copy;
+                return 0;
         }
 
-        if (alias_count >= 16) {
+        alias = kmalloc(sizeof(*alias));
+
+        if (alias) {
+                alias->name = shell_strdup(name);
+        }
+
+        if (!alias || !alias->name) {
+                kfree(alias);
+                kfree(copy);
                 return -1;
         }
 
-        shell_strncpy(alias_table[alias_count].name, name, sizeof(alias_table[alias_count].name));
-        shell_strncpy(alias_table[alias_count].expansion, expansion, sizeof(alias_table[alias_count].expansion));
-        alias_count++;
+        alias->expansion = copy;
+        alias->next = NULL;
+        link = &alias_list;
 
+        while (*link) {
+                link = &(*link)->next;
+        }
+
+        *link = alias;
         return 0;
 }
 
 static const char* shell_alias_lookup(const char* name)
 {
-        for (int i = 0; i < alias_count; ++i) {
-                if (shell_streq(alias_table[i].name, name)) {
-                        return alias_table[i].expansion;
-                }
-        }
+        ShellAlias* alias = shell_alias_find(name);
 
-        return NULL;
+        return alias ? alias->expansion : NULL;
 }
 
-void shell_capture_output_begin(char* buffer, size_t capacity)
+/*
+ * Redirected output is staged in a small chunk and streamed into the open
+ * file, so a command can produce any amount of output in constant memory.
+ */
+static void shell_capture_flush(void)
 {
-	capture_buffer = buffer;
-	capture_capacity = capacity;
-	capture_length = 0;
-
-	if (capture_buffer && capture_capacity > 0) {
-		capture_buffer[0] = '\0';
+	if (capture_length > 0 && fs_write_fd(capture_fd, capture_chunk, capture_length) < 0) {
+		capture_failed = true;
 	}
 
+	capture_length = 0;
+}
+
+void shell_capture_output_begin(int fd)
+{
+	capture_fd = fd;
+	capture_length = 0;
+	capture_failed = false;
 	capture_active = true;
 }
 
-void shell_capture_output_end(void)
+int shell_capture_output_end(void)
 {
+	shell_capture_flush();
 	capture_active = false;
-	capture_buffer = NULL;
-	capture_capacity = 0;
-	capture_length = 0;
+	capture_fd = -1;
+
+	return capture_failed ? -1 : 0;
 }
 
 void shell_output_char(char c)
 {
-	if (capture_active && capture_buffer && capture_capacity > 0) {
-		if (capture_length + 1 < capture_capacity) {
-			capture_buffer[capture_length++] = c;
-			capture_buffer[capture_length] = '\0';
+	if (capture_active) {
+		capture_chunk[capture_length++] = c;
+		if (capture_length == sizeof(capture_chunk)) {
+			shell_capture_flush();
 		}
 		return;
 	}
@@ -206,6 +228,17 @@ void shell_output_string(const char* data)
 	}
 }
 
+void shell_output_bytes(const char* data, size_t len)
+{
+	if (!data) {
+		return;
+	}
+
+	for (size_t i = 0; i < len; ++i) {
+		shell_output_char(data[i]);
+	}
+}
+
 void shell_print_path(FSNode* node)
 {
 	FSNode* stack[32];
@@ -227,7 +260,7 @@ void shell_print_path(FSNode* node)
 			continue;
 		}
 
-		shell_output_string(current->name);
+		shell_output_string(fs_name(current));
 		if (i > 0) {
 			shell_output_char('/');
 		}
@@ -318,66 +351,6 @@ static int find_redirect_index(char* argv[], size_t argc, bool* append)
         return -1;
 }
 
-static FSNode* resolve_parent_for_path(const char* path, char* leaf, size_t leaf_size)
-{
-        char parent_path[128];
-        size_t len;
-        int last_sep = -1;
-
-        if (!path || !leaf) {
-                return NULL;
-        }
-
-        len = shell_strlen(path);
-
-        while (len > 1 && path[len - 1] == '/') {
-                --len;
-        }
-
-        for (size_t i = 0; i < len; ++i) {
-                if (path[i] == '/') {
-                        last_sep = (int)i;
-                }
-        }
-
-        if (last_sep == -1) {
-                shell_strncpy(leaf, path, leaf_size);
-                return fs_get_cwd();
-        }
-
-        if ((size_t)last_sep >= len - 1) {
-                return NULL;
-        }
-
-        if (last_sep == 0) {
-                parent_path[0] = '/';
-                parent_path[1] = '\0';
-        } else {
-                size_t copy_len = (size_t)last_sep;
-
-                if (copy_len >= sizeof(parent_path)) {
-                        copy_len = sizeof(parent_path) - 1;
-                }
-
-                for (size_t i = 0; i < copy_len; ++i) {
-                        parent_path[i] = path[i];
-                }
-                parent_path[copy_len] = '\0';
-        }
-
-        shell_strncpy(leaf, path + last_sep + 1, leaf_size);
-
-        {
-                FSNode* parent = fs_resolve_path(fs_get_cwd(), parent_path);
-
-                if (parent && fs_is_dir(parent)) {
-                        return parent;
-                }
-        }
-
-        return NULL;
-}
-
 static void dispatch_command(char* argv[], size_t argc)
 {
 	(void)argc;
@@ -398,8 +371,9 @@ static void handle_command(char* input)
         char* argv[12];
         size_t argc;
         char original[128];
+        char expanded_line[128]; // argv points into it after alias expansion
 
-        shell_strncpy(original, input, sizeof(original));
+        strlcpy(original, input, sizeof(original));
 
         argc = tokenize(input, argv, sizeof(argv) - 1);
         if (argc == 0) {
@@ -414,7 +388,6 @@ static void handle_command(char* input)
                 const char* expansion = shell_alias_lookup(argv[0]);
 
                 if (expansion) {
-                        char expanded_line[128];
                         size_t write_pos = 0;
 
                         for (size_t i = 0; expansion[i] != '\0' && write_pos + 1 < sizeof(expanded_line); ++i) {
@@ -422,7 +395,7 @@ static void handle_command(char* input)
                         }
 
                         for (size_t i = 1; i < argc; ++i) {
-                                size_t arg_len = shell_strlen(argv[i]);
+                                size_t arg_len = strlen(argv[i]);
 
                                 if (write_pos + arg_len + 1 >= sizeof(expanded_line)) {
                                         shell_output_string("alias: expansion too long\n");
@@ -439,21 +412,25 @@ static void handle_command(char* input)
                         expanded_line[write_pos] = '\0';
                         argc = tokenize(expanded_line, argv, sizeof(argv) - 1);
                         argv[argc] = NULL;
+
+                        if (argc == 0) {
+                                return;
+                        }
                 }
         }
 
-        if (shell_streq(argv[0], "history")) {
+        if (strcmp(argv[0], "history") == 0) {
                 shell_print_history();
                 return;
         }
 
-        if (shell_streq(argv[0], "alias")) {
+        if (strcmp(argv[0], "alias") == 0) {
                 if (argc == 1) {
-                        for (int i = 0; i < alias_count; ++i) {
-                                shell_output_string(alias_table[i].name);
+                        for (ShellAlias* alias = alias_list; alias; alias = alias->next) {
+                                shell_output_string(alias->name);
                                 shell_output_string("=");
                                 shell_output_char('"');
-                                shell_output_string(alias_table[i].expansion);
+                                shell_output_string(alias->expansion);
                                 shell_output_char('"');
                                 shell_output_char('\n');
                         }
@@ -487,12 +464,10 @@ static void handle_command(char* input)
                                         name_len = sizeof(name) - 1;
                                 }
 
-                                for (size_t k = 0; k < name_len; ++k) {
-                                        name[k] = entry[k];
-                                }
+                                memcpy(name, entry, name_len);
                                 name[name_len] = '\0';
 
-                                shell_strncpy(expansion, entry + equal_pos + 1, sizeof(expansion));
+                                strlcpy(expansion, entry + equal_pos + 1, sizeof(expansion));
 
                                 if (shell_alias_set(name, expansion) != 0) {
                                         shell_output_string("alias: failed to set alias\n");
@@ -504,7 +479,7 @@ static void handle_command(char* input)
                 return;
         }
 
-        if (shell_streq(argv[0], "clear")) {
+        if (strcmp(argv[0], "clear") == 0) {
                 terminal_clear_screen();
                 terminal_set_cursor(0, 0);
                 return;
@@ -516,10 +491,10 @@ static void handle_command(char* input)
 
                 if (redirect_index != -1) {
                         char* filename;
-                        char buffer[1024];
                         FSNode* parent;
                         char leaf[32];
                         FSNode* file;
+                        int fd;
 
                         if ((size_t)redirect_index + 1 >= argc) {
                                 shell_output_string("redirection: missing file\n");
@@ -529,11 +504,7 @@ static void handle_command(char* input)
                         filename = argv[redirect_index + 1];
                         argv[redirect_index] = NULL;
 
-                        shell_capture_output_begin(buffer, sizeof(buffer));
-                        dispatch_command(argv, (size_t)redirect_index);
-                        shell_capture_output_end();
-
-                        parent = resolve_parent_for_path(filename, leaf, sizeof(leaf));
+                        parent = fs_resolve_parent(fs_get_cwd(), filename, leaf, sizeof(leaf));
 
                         if (!parent) {
                                 shell_output_string("redirection: invalid path\n");
@@ -545,15 +516,20 @@ static void handle_command(char* input)
                                 file = fs_create_file(parent, leaf);
                         }
 
-                        if (!file) {
+                        fd = fs_open(file, FS_OPEN_WRITE | (append ? FS_OPEN_APPEND : FS_OPEN_TRUNC));
+                        if (fd < 0) {
                                 shell_output_string("redirection: failed to write file\n");
                                 return;
                         }
 
-                        if ((!append && fs_write(file, buffer) != 0) || (append && fs_append(file, buffer) != 0)) {
+                        shell_capture_output_begin(fd);
+                        dispatch_command(argv, (size_t)redirect_index);
+
+                        if (shell_capture_output_end() != 0) {
                                 shell_output_string("redirection: failed to write file\n");
                         }
 
+                        fs_close(fd);
                         return;
                 }
         }
@@ -561,6 +537,79 @@ static void handle_command(char* input)
         dispatch_command(argv, argc);
 }
 
+/*
+ * Complete the last word of the line as a path. Directory entries are kept
+ * in name order, so every candidate sits in one run of siblings starting at
+ * fs_lookup_prefix; the line is extended by the prefix they all share.
+ */
+static void shell_complete(char* input, size_t* length, size_t capacity)
+{
+        size_t word = *length;
+        size_t leaf = *length;
+        size_t prefix_len;
+        size_t common;
+        size_t matches = 0;
+        FSNode* dir = fs_get_cwd();
+        FSNode* first;
+        const char* first_name;
+
+        while (word > 0 && input[word - 1] != ' ') {
+                --word;
+        }
+
+        while (leaf > word && input[leaf - 1] != '/') {
+                --leaf;
+        }
+
+        if (leaf > word) {
+                char saved = input[leaf];
+
+                input[leaf] = '\0';
+                dir = fs_resolve_path(dir, input + word);
+                input[leaf] = saved;
+        }
+
+        input[*length] = '\0';
+        first = fs_lookup_prefix(dir, input + leaf);
+        if (!first) {
+                return;
+        }
+
+        prefix_len = *length - leaf;
+        first_name = fs_name(first);
+        common = strlen(first_name);
+
+        for (FSNode* node = first; node; node = node->next_sibling) {
+                const char* name = fs_name(node);
+                size_t shared = 0;
+
+                while (shared < prefix_len && name[shared] == input[leaf + shared]) {
+                        ++shared;
+                }
+
+                if (shared < prefix_len) {
+                        break;
+                }
+
+                while (shared < common && name[shared] == first_name[shared]) {
+                        ++shared;
+                }
+
+                common = shared;
+                ++matches;
+        }
+
+        for (size_t i = prefix_len; i < common && *length < capacity - 1; ++i) {
+                input[(*length)++] = first_name[i];
+                terminal_putchar(first_name[i]);
+        }
+
+        if (matches == 1 && fs_is_dir(first) && *length < capacity - 1) {
+                input[(*length)++] = '/';
+                terminal_putchar('/');
+        }
+}
+
 void enzos_shell(void)
 {
 	char input[128];
@@ -581,6 +630,11 @@ void enzos_shell(void)
 			continue;
 		}
 
+		if (c == '\t') {
+			shell_complete(input, &length, sizeof(input));
+			continue;
+		}
+
 		if (length < sizeof(input) - 1) {
 			input[length++] = c;
 			terminal_putchar(c);
@@ -9,8 +9,10 @@
 void enzos_shell(void);
 void shell_output_char(char c);
 void shell_output_string(const char* data);
-void shell_capture_output_begin(char* buffer, size_t capacity);
-void shell_capture_output_end(void);
+void shell_output_bytes(const char* data, size_t len);
+void shell_output_number(int number);
+void shell_capture_output_begin(int fd);
+int shell_capture_output_end(void);
 void shell_print_path(FSNode* node);
 
 #endif /* ENZOS_SHELL_SHELL_H */
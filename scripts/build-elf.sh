@@ -57,6 +57,24 @@ build_objects() {
     -c "$REPO_ROOT/src/fs.c" \
     -o "$BUILD_DIR/fs.o"
 
+  echo "[build-elf] Compiling buffer cache..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/bcache.c" \
+    -o "$BUILD_DIR/bcache.o"
+
+  echo "[build-elf] Compiling disk filesystem..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/diskfs.c" \
+    -o "$BUILD_DIR/diskfs.o"
+
+  echo "[build-elf] Compiling initrd loader..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/initrd.c" \
+    -o "$BUILD_DIR/initrd.o"
+
   echo "[build-elf] Compiling shell..."
   $CC \
     "${COMMON_CFLAGS[@]}" \
@@ -69,6 +87,60 @@ build_objects() {
     -c "$REPO_ROOT/src/shell/commands.c" \
     -o "$BUILD_DIR/commands.o"
 
+  echo "[build-elf] Compiling CPU feature setup..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/cpu.c" \
+    -o "$BUILD_DIR/cpu.o"
+
+  echo "[build-elf] Compiling physical memory manager..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/mm/pmm.c" \
+    -o "$BUILD_DIR/pmm.o"
+
+  echo "[build-elf] Compiling paging setup..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/mm/paging.c" \
+    -o "$BUILD_DIR/paging.o"
+
+  echo "[build-elf] Compiling kernel heap..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/mm/kmalloc.c" \
+    -o "$BUILD_DIR/kmalloc.o"
+
+  echo "[build-elf] Compiling kernel string library..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/libk/string.c" \
+    -o "$BUILD_DIR/string.o"
+
+  echo "[build-elf] Compiling substring search..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/search.c" \
+    -o "$BUILD_DIR/search.o"
+
+  echo "[build-elf] Compiling PCI bus driver..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/drivers/pci.c" \
+    -o "$BUILD_DIR/pci.o"
+
+  echo "[build-elf] Compiling block layer..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/drivers/block.c" \
+    -o "$BUILD_DIR/block.o"
+
+  echo "[build-elf] Compiling ATA driver..."
+  $CC \
+    "${COMMON_CFLAGS[@]}" \
+    -c "$REPO_ROOT/src/drivers/ata.c" \
+    -o "$BUILD_DIR/ata.o"
+
   echo "[build-elf] Compiling terminal driver..."
   $CC \
     "${COMMON_CFLAGS[@]}" \
@@ -90,7 +162,7 @@ link_kernel() {
     -ffreestanding \
     -O2 \
     -nostdlib \
-    "$BUILD_DIR/kernel_entry.o" "$BUILD_DIR/kernel.o" "$BUILD_DIR/fs.o" "$BUILD_DIR/shell.o" "$BUILD_DIR/commands.o" "$BUILD_DIR/terminal.o" "$BUILD_DIR/keyboard.o" \
+    "$BUILD_DIR/kernel_entry.o" "$BUILD_DIR/kernel.o" "$BUILD_DIR/fs.o" "$BUILD_DIR/bcache.o" "$BUILD_DIR/diskfs.o" "$BUILD_DIR/initrd.o" "$BUILD_DIR/shell.o" "$BUILD_DIR/commands.o" "$BUILD_DIR/cpu.o" "$BUILD_DIR/pmm.o" "$BUILD_DIR/kmalloc.o" "$BUILD_DIR/paging.o" "$BUILD_DIR/string.o" "$BUILD_DIR/search.o" "$BUILD_DIR/terminal.o" "$BUILD_DIR/keyboard.o" "$BUILD_DIR/pci.o" "$BUILD_DIR/block.o" "$BUILD_DIR/ata.o" \
     "${LIBS[@]}"
 }
 
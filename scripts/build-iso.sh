@@ -40,15 +40,23 @@ stage_iso_root() {
   cp "$REPO_ROOT/grub/grub.cfg" "$GRUB_DIR/grub.cfg"
 }
 
+pack_initrd() {
+  # The kernel mounts this archive read-only at /initrd, reading file data in
+  # place, so it must stay a plain (uncompressed) ustar archive.
+  echo "[build-iso] Packing initrd..."
+  tar --format=ustar -C "$REPO_ROOT/initrd" -cf "$BOOT_DIR/initrd.tar" .
+}
+
 create_iso() {
   echo "[build-iso] Creating ISO image..."
   grub-mkrescue -o "$ISO_OUTPUT" "$ISO_ROOT"
 }
 
 main() {
-  require_tools grub-mkrescue xorriso mtools
+  require_tools grub-mkrescue xorriso mtools tar
   verify_kernel_exists
   stage_iso_root
+  pack_initrd
   create_iso
 
   echo "[build-iso] Done! Output: $ISO_OUTPUT"
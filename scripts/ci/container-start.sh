@@ -7,11 +7,18 @@ set -euo pipefail
 QEMU_MONITOR_ADDR="${QEMU_MONITOR_ADDR:-127.0.0.1:45454}"
 VNC_PORT="${VNC_PORT:-1}"
 QEMU_PIDFILE="${QEMU_PIDFILE:-/tmp/qemu-ci.pid}"
+DISK_IMAGE="${DISK_IMAGE:-/tmp/enzos-disk.img}"
+
+# Blank 16 MiB scratch disk for the ATA driver (primary master), recreated on
+# every start so nothing a previous run wrote survives.
+rm -f "$DISK_IMAGE"
+truncate -s 16M "$DISK_IMAGE"
 
 echo "Starting QEMU with monitor on $QEMU_MONITOR_ADDR and VNC port $VNC_PORT..."
 
 qemu-system-x86_64 \
   -cdrom /src/enzos.iso \
+  -drive file="$DISK_IMAGE",format=raw,if=ide,index=0,media=disk \
   -serial none \
   -no-reboot \
   -no-shutdown \
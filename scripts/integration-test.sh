@@ -7,6 +7,7 @@ set -euo pipefail
 SCRIPT_DIR="$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)"
 PROJECT_ROOT="$(cd "$SCRIPT_DIR/.." && pwd)"
 ISO_PATH="${ISO_PATH:-$PROJECT_ROOT/os/enzos.iso}"
+DISK_IMAGE="${DISK_IMAGE:-$PROJECT_ROOT/os/build/disk.img}"
 QEMU_MONITOR_ADDR="127.0.0.1:45454"
 HEADLESS="${HEADLESS:-false}"
 SKIP_TESTS="${SKIP_TESTS:-false}"
@@ -32,6 +33,13 @@ fi
 
 log "Using ISO: $ISO_PATH"
 
+# Blank 16 MiB scratch disk for the ATA driver (primary master). Recreated
+# on every run: scenarios such as mkfs write to it, and a leftover image would
+# leak that state into the next run.
+mkdir -p "$(dirname "$DISK_IMAGE")"
+rm -f "$DISK_IMAGE"
+truncate -s 16M "$DISK_IMAGE"
+
 # Clean up any existing QEMU processes
 pkill -f "qemu-system.*${ISO_PATH##*/}" 2>/dev/null || true
 sleep 1
@@ -50,6 +58,7 @@ log ""
 # Start QEMU in background
 qemu-system-x86_64 \
   -cdrom "$ISO_PATH" \
+  -drive file="$DISK_IMAGE",format=raw,if=ide,index=0,media=disk \
   -no-reboot \
   -no-shutdown \
   -monitor "tcp:${QEMU_MONITOR_ADDR},server=on,wait=off" \
@@ -0,0 +1,43 @@
+#!/usr/bin/env bash
+set -euo pipefail
+
+# Build tests/libk/string_test.c together with os/src/libk/string.c as a
+# 32-bit static Linux binary and run it. The test needs no libc, so either
+# the host compiler in -m32 mode or the i686-elf cross compiler will do.
+
+REPO_ROOT="$(cd "$(dirname "${BASH_SOURCE[0]}")/.." && pwd)"
+BUILD_DIR="$REPO_ROOT/os/build"
+EXTRA_CFLAGS=()
+LIBS=()
+
+if command -v gcc >/dev/null 2>&1; then
+  CC="gcc -m32"
+  EXTRA_CFLAGS=(-DALLOW_HOST_TOOLCHAIN)
+elif command -v i686-elf-gcc >/dev/null 2>&1; then
+  CC=i686-elf-gcc
+  LIBS=(-lgcc)
+else
+  echo "[test-libk] Need gcc (with -m32 support) or i686-elf-gcc." >&2
+  exit 1
+fi
+
+mkdir -p "$BUILD_DIR"
+
+echo "[test-libk] Building string tests..."
+# Keep GCC from turning the reference loops into calls to the code under test.
+$CC \
+  -std=gnu99 \
+  -ffreestanding \
+  -fno-tree-loop-distribute-patterns \
+  -O2 \
+  -Wall -Wextra \
+  -static -nostdlib \
+  -I "$REPO_ROOT/os/src" \
+  "${EXTRA_CFLAGS[@]}" \
+  "$REPO_ROOT/tests/libk/string_test.c" \
+  "$REPO_ROOT/os/src/libk/string.c" \
+  -o "$BUILD_DIR/libk_string_test" \
+  "${LIBS[@]}"
+
+echo "[test-libk] Running string tests..."
+"$BUILD_DIR/libk_string_test"
@@ -105,6 +105,62 @@ func TestShellScenarios(t *testing.T) {
 			WaitForPrompt:    true,
 			CheckPromptAfter: true,
 		},
+		{
+			Name:             "Cat Initrd File",
+			Command:          "cat /initrd/README.txt",
+			Expected:         "initrd",
+			WaitForPrompt:    true,
+			CheckPromptAfter: true,
+		},
+		{
+			Name:             "Find By Name",
+			Command:          "find / -name *.txt",
+			Expected:         "/initrd/README.txt",
+			WaitForPrompt:    true,
+			CheckPromptAfter: true,
+		},
+		{
+			Name:             "Grep Recursively",
+			Command:          "grep -r initrd /initrd",
+			Expected:         "/initrd/README.txt:",
+			WaitForPrompt:    true,
+			CheckPromptAfter: true,
+		},
+		{
+			Name:             "Count Words",
+			Command:          "echo b > words\necho a >> words\nwc words\nrm words",
+			Expected:         "2 2 4 words",
+			WaitForPrompt:    true,
+			CheckPromptAfter: true,
+		},
+		{
+			Name:             "Filesystem Statistics",
+			Command:          "fsstat",
+			Expected:         "nodes:",
+			WaitForPrompt:    true,
+			CheckPromptAfter: true,
+		},
+		{
+			Name:             "Free Memory",
+			Command:          "free",
+			Expected:         "KiB free",
+			WaitForPrompt:    true,
+			CheckPromptAfter: true,
+		},
+		{
+			Name:             "List Block Devices",
+			Command:          "lsblk",
+			Expected:         "ata0",
+			WaitForPrompt:    true,
+			CheckPromptAfter: true,
+		},
+		{
+			Name:             "Format Disk",
+			Command:          "mkfs",
+			Expected:         "Formatted ata0",
+			WaitForPrompt:    true,
+			CheckPromptAfter: true,
+		},
 		{
 			Name:             "Change Directory",
 			Command:          "cd /\nmkdir home\ncd home\npwd",
@@ -0,0 +1,341 @@
+/*
+ * Host-side correctness test for os/src/libk/string.c, run by
+ * scripts/test-libk.sh. It is built like the kernel (32-bit, freestanding, no
+ * libc) and talks to Linux through int $0x80, so the exact i386 code the
+ * kernel runs is what gets tested. Every routine is compared against a naive
+ * byte loop over a sweep of alignments and lengths, with the SSE2 paths both
+ * off and on, and every kernel_fpu_begin must be matched by kernel_fpu_end.
+ * Strings are also placed against an unmapped page to check that
+ * word-at-a-time scans never read across it.
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include "libk/string.h"
+
+#define SYS_EXIT 1
+#define SYS_WRITE 4
+#define SYS_MUNMAP 91
+#define SYS_MMAP2 192
+
+#define PAGE 4096
+#define BUFFER 1024
+#define MAX_LEN 600
+
+static bool sse = false;
+static unsigned int fpu_depth = 0;
+static unsigned int failures = 0;
+static uint32_t seed = 12345;
+
+// Stand-ins for cpu.c. The depth shows whether every section was closed.
+bool kernel_fpu_begin(void)
+{
+        if (sse) {
+                ++fpu_depth;
+        }
+
+        return sse;
+}
+
+void kernel_fpu_end(void)
+{
+        --fpu_depth;
+}
+
+static long syscall3(long number, long a, long b, long c)
+{
+        long result;
+
+        __asm__ volatile("int $0x80" : "=a"(result) : "a"(number), "b"(a), "c"(b), "d"(c) : "memory");
+        return result;
+}
+
+// Anonymous read-write pages; mmap2 takes its sixth argument in ebp.
+static long mmap_pages(long count)
+{
+        long result;
+
+        __asm__ volatile("push %%ebp\n\txor %%ebp, %%ebp\n\tint $0x80\n\tpop %%ebp"
+                : "=a"(result)
+                : "a"(SYS_MMAP2), "b"(0), "c"(count * PAGE), "d"(3 /* PROT_READ | PROT_WRITE */),
+                  "S"(0x22 /* MAP_PRIVATE | MAP_ANONYMOUS */), "D"(-1)
+                : "memory");
+        return result;
+}
+
+static void print(const char* text)
+{
+        size_t len = 0;
+
+        while (text[len] != '\0') {
+                ++len;
+        }
+
+        syscall3(SYS_WRITE, 1, (long)text, (long)len);
+}
+
+static void print_number(unsigned int value)
+{
+        char digits[12];
+        int count = 0;
+
+        do {
+                digits[count++] = (char)('0' + value % 10);
+                value /= 10;
+        } while (value > 0);
+
+        while (count > 0) {
+                char c = digits[--count];
+
+                syscall3(SYS_WRITE, 1, (long)&c, 1);
+        }
+}
+
+static void fail(const char* what, unsigned int a, unsigned int b, unsigned int c)
+{
+        if (failures++ < 20) {
+                print("FAIL ");
+                print(what);
+                print(" ");
+                print_number(a);
+                print(" ");
+                print_number(b);
+                print(" ");
+                print_number(c);
+                print(sse ? " (sse)\n" : "\n");
+        }
+}
+
+static uint32_t next_random(void)
+{
+        seed = seed * 1103515245u + 12345u;
+        return seed >> 8;
+}
+
+static int sign(int value)
+{
+        return (value > 0) - (value < 0);
+}
+
+static unsigned char source[BUFFER + 64];
+static unsigned char dest[BUFFER + 64];
+static unsigned char expect[BUFFER + 64];
+
+static void randomize(unsigned char* buffer, size_t len)
+{
+        for (size_t i = 0; i < len; ++i) {
+                buffer[i] = (unsigned char)next_random();
+        }
+}
+
+static bool same(const unsigned char* a, const unsigned char* b, size_t len)
+{
+        for (size_t i = 0; i < len; ++i) {
+                if (a[i] != b[i]) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+static void test_copy_and_fill(size_t len, size_t src_offset, size_t dest_offset)
+{
+        randomize(source, sizeof(source));
+        randomize(dest, sizeof(dest));
+
+        for (size_t i = 0; i < sizeof(dest); ++i) {
+                expect[i] = dest[i];
+        }
+        for (size_t i = 0; i < len; ++i) {
+                expect[dest_offset + i] = source[src_offset + i];
+        }
+
+        if (memcpy(dest + dest_offset, source + src_offset, len) != dest + dest_offset
+                || !same(dest, expect, sizeof(dest))) {
+                fail("memcpy", len, src_offset, dest_offset);
+        }
+
+        for (size_t i = 0; i < len; ++i) {
+                expect[dest_offset + i] = (unsigned char)(0x5a + len);
+        }
+
+        if (memset(dest + dest_offset, 0x15a + (int)len, len) != dest + dest_offset
+                || !same(dest, expect, sizeof(dest))) {
+                fail("memset", len, src_offset, dest_offset);
+        }
+}
+
+static void test_move(size_t len, size_t from, size_t to)
+{
+        randomize(source, sizeof(source));
+
+        for (size_t i = 0; i < sizeof(source); ++i) {
+                expect[i] = source[i];
+        }
+        for (size_t i = 0; i < len; ++i) {
+                expect[to + i] = source[from + i];
+        }
+
+        if (memmove(source + to, source + from, len) != source + to || !same(source, expect, sizeof(source))) {
+                fail("memmove", len, from, to);
+        }
+}
+
+static void test_compare(size_t len, size_t offset)
+{
+        size_t diff = len ? next_random() % len : 0;
+        int reference = 0;
+
+        randomize(source, sizeof(source));
+
+        for (size_t i = 0; i < len; ++i) {
+                dest[offset + i] = source[i];
+        }
+        if (len) {
+                dest[offset + diff] = (unsigned char)(source[diff] + 1 + next_random() % 255);
+                reference = source[diff] - dest[offset + diff];
+        }
+
+        if (sign(memcmp(source, dest + offset, len)) != sign(reference)) {
+                fail("memcmp", len, offset, diff);
+        }
+        if (memcmp(source, source, len) != 0) {
+                fail("memcmp-equal", len, offset, 0);
+        }
+}
+
+static void test_strings(size_t len, size_t offset)
+{
+        char* a = (char*)source + offset;
+        char* b = (char*)dest + (offset * 7) % 8;
+        size_t cut = len ? next_random() % len : 0;
+        unsigned char byte = (unsigned char)(1 + next_random() % 255);
+        char copy[64];
+        void* found;
+
+        for (size_t i = 0; i < len; ++i) {
+                a[i] = (char)(1 + next_random() % 255);
+                b[i] = a[i];
+        }
+        a[len] = '\0';
+        b[len] = '\0';
+
+        if (strlen(a) != len) {
+                fail("strlen", len, offset, (unsigned int)strlen(a));
+        }
+        if (strnlen(a, cut) != cut || strnlen(a, len + 5) != len) {
+                fail("strnlen", len, offset, cut);
+        }
+        if (strcmp(a, b) != 0 || strncmp(a, b, len + 3) != 0) {
+                fail("strcmp-equal", len, offset, 0);
+        }
+
+        found = memchr(a, byte, len);
+        for (size_t i = 0; i <= len; ++i) {
+                if (i == len || (unsigned char)a[i] == byte) {
+                        if (found != (i == len ? NULL : a + i)) {
+                                fail("memchr", len, offset, byte);
+                        }
+                        break;
+                }
+        }
+        if (memchr(a, 0, len + 1) != a + len) {
+                fail("memchr-zero", len, offset, 0);
+        }
+
+        if (len) {
+                int reference;
+
+                b[cut] = (char)(b[cut] == (char)0xff ? 1 : b[cut] + 1);
+                reference = (unsigned char)a[cut] - (unsigned char)b[cut];
+
+                if (sign(strcmp(a, b)) != sign(reference) || sign(strncmp(a, b, len)) != sign(reference)) {
+                        fail("strcmp", len, offset, cut);
+                }
+                if (strncmp(a, b, cut) != 0) {
+                        fail("strncmp-prefix", len, offset, cut);
+                }
+
+                b[cut] = '\0';
+                if (sign(strcmp(a, b)) != 1 || sign(strcmp(b, a)) != -1) {
+                        fail("strcmp-short", len, offset, cut);
+                }
+        }
+
+        if (strlcpy(copy, a, sizeof(copy)) != len || strlen(copy) != (len < sizeof(copy) ? len : sizeof(copy) - 1)
+                || strncmp(copy, a, sizeof(copy) - 1) != 0) {
+                fail("strlcpy", len, offset, 0);
+        }
+}
+
+// Strings that end right before an unmapped page must not fault.
+static void test_page_edge(void)
+{
+        long base = mmap_pages(2);
+        char* edge;
+
+        if (base < 0 && base > -4096) {
+                fail("mmap", 0, 0, 0);
+                return;
+        }
+
+        syscall3(SYS_MUNMAP, base + PAGE, PAGE, 0);
+        edge = (char*)base + PAGE;
+
+        for (size_t len = 0; len < 12; ++len) {
+                char* str = edge - len - 1;
+
+                for (size_t i = 0; i < len; ++i) {
+                        str[i] = 'x';
+                }
+                str[len] = '\0';
+
+                if (strlen(str) != len || strcmp(str, str) != 0 || memchr(str, 0, len + 1) != str + len
+                        || strnlen(str, len + 1) != len) {
+                        fail("page-edge", len, 0, 0);
+                }
+        }
+}
+
+static void run_sweep(void)
+{
+        for (size_t len = 0; len < MAX_LEN; len += len < 80 ? 1 : 37) {
+                for (size_t offset = 0; offset < 16; ++offset) {
+                        test_copy_and_fill(len, offset, (offset * 5 + len) % 16);
+                        test_move(len, offset, offset + 1 + len % 9);
+                        test_move(len, offset + 1 + len % 9, offset);
+                        test_compare(len, offset);
+                        if (len < BUFFER - 16) {
+                                test_strings(len, offset);
+                        }
+                }
+        }
+
+        test_page_edge();
+}
+
+// Linux enters with a 16-byte aligned stack but no return address pushed.
+__attribute__((force_align_arg_pointer))
+void _start(void)
+{
+        sse = false;
+        run_sweep();
+        sse = true;
+        run_sweep();
+
+        if (fpu_depth != 0) {
+                fail("kernel_fpu_end balance", fpu_depth, 0, 0);
+        }
+
+        if (failures) {
+                print_number(failures);
+                print(" libk checks failed\n");
+        } else {
+                print("libk string tests passed\n");
+        }
+
+        syscall3(SYS_EXIT, failures ? 1 : 0, 0, 0);
+
+        for (;;) {
+        }
+}